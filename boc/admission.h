@@ -0,0 +1,185 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <debug/harness.h>
+
+namespace boc
+{
+  /*
+   * Admission control bounds the number of outstanding behaviours spawned through an
+   * Admission, either one shared instance or one per scheduling source (see Admissions).
+   *
+   * - A behaviour is admitted before it is spawned and its closure is wrapped with track,
+   *   which releases the admission when the behaviour completes.
+   * - When the bound is reached the spawner chooses what to do:
+   *   - try_admit fails and the spawner can fall back to doing the work inline, or
+   *   - for_each parks the rest of a loop of spawns and resumes it from whichever behaviour
+   *     releases an admission, so spawners are throttled without blocking a worker.
+   * - A bound of 0 means unbounded, admission always succeeds but is still counted.
+   */
+  class Admission
+  {
+    const size_t bound;
+    std::atomic<size_t> in_flight{0};
+    std::atomic<size_t> peak{0};
+    std::atomic<size_t> refused{0};
+
+    std::mutex lock;
+    std::function<void()> parked;
+    std::atomic<bool> has_parked{false};
+
+    void resume() {
+      std::function<void()> k;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        k = std::move(parked);
+        parked = nullptr;
+        has_parked = false;
+      }
+      if (k)
+        k();
+    }
+
+  public:
+    Admission(size_t bound): bound(bound) {}
+
+    size_t outstanding() const { return in_flight; }
+
+    size_t max_outstanding() const { return peak; }
+
+    size_t refusals() const { return refused; }
+
+    /*
+     * Admits count behaviours at once, or none of them.
+     */
+    bool try_admit(size_t count = 1) {
+      size_t n = in_flight.load(std::memory_order_relaxed);
+      do {
+        if (bound != 0 && n + count > bound) {
+          refused++;
+          return false;
+        }
+      } while (!in_flight.compare_exchange_weak(n, n + count));
+
+      size_t p = peak.load(std::memory_order_relaxed);
+      while (n + count > p && !peak.compare_exchange_weak(p, n + count, std::memory_order_relaxed)) {}
+      return true;
+    }
+
+    void release() {
+      in_flight--;
+      if (has_parked)
+        resume();
+    }
+
+    /*
+     * Wraps the closure of an admitted behaviour so the admission is released once it has run.
+     */
+    template<typename F>
+    auto track(F&& f)
+    {
+      return [this, f = std::forward<F>(f)](auto&&... args) mutable {
+        f(std::forward<decltype(args)>(args)...);
+        release();
+      };
+    }
+
+    /*
+     * Calls spawn(i) for each i in [from, to), each call spawns weight admitted behaviours.
+     * When the bound is reached the remaining calls are parked until a behaviour completes.
+     * then is called once the last spawn has been made, so anything it spawns is ordered
+     * after every behaviour spawned by the loop.
+     * Only one loop may be parked on an Admission at a time, and weight must not exceed the
+     * bound or the loop could never be admitted.
+     */
+    template<typename S, typename T>
+    void for_each(size_t from, size_t to, size_t weight, S spawn, T then)
+    {
+      if (bound != 0 && weight > bound)
+        throw std::invalid_argument("admission weight " + std::to_string(weight) + " exceeds bound " + std::to_string(bound));
+      while (from < to) {
+        if (!try_admit(weight)) {
+          {
+            std::lock_guard<std::mutex> guard(lock);
+            parked = [this, from, to, weight, spawn, then]() mutable { for_each(from, to, weight, spawn, then); };
+            has_parked = true;
+          }
+          // a behaviour may have completed between failing to admit and parking
+          if (in_flight + weight <= bound)
+            resume();
+          return;
+        }
+        spawn(from++);
+      }
+      then();
+    }
+  };
+
+  /*
+   * One Admission of bound per scheduling source, the thread spawning the behaviours, so each
+   * source is throttled by its own outstanding behaviours only.  A behaviour releases the
+   * Admission that admitted it, whichever thread it completes on.
+   */
+  class Admissions
+  {
+    static std::atomic<uint64_t>& next_id() {
+      static std::atomic<uint64_t> id{1};
+      return id;
+    }
+
+    const uint64_t id = next_id()++;
+    const size_t bound;
+    std::mutex lock;
+    std::unordered_map<std::thread::id, std::unique_ptr<Admission>> sources;
+
+  public:
+    Admissions(size_t bound): bound(bound) {}
+
+    // the Admission of the calling thread
+    Admission& local() {
+      thread_local uint64_t owner = 0;
+      thread_local Admission* cached = nullptr;
+      if (owner != id) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto& a = sources[std::this_thread::get_id()];
+        if (!a)
+          a = std::make_unique<Admission>(bound);
+        cached = a.get();
+        owner = id;
+      }
+      return *cached;
+    }
+
+    // the largest number of behaviours any one source had outstanding
+    size_t max_outstanding() {
+      std::lock_guard<std::mutex> guard(lock);
+      size_t peak = 0;
+      for (auto& [thread, a] : sources)
+        peak = std::max(peak, a->max_outstanding());
+      return peak;
+    }
+
+    size_t refusals() {
+      std::lock_guard<std::mutex> guard(lock);
+      size_t refused = 0;
+      for (auto& [thread, a] : sources)
+        refused += a->refusals();
+      return refused;
+    }
+
+    size_t count() {
+      std::lock_guard<std::mutex> guard(lock);
+      return sources.size();
+    }
+  };
+}
@@ -0,0 +1,139 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc
+{
+  using verona::cpp::acquired_cown;
+  using verona::cpp::acquired_cown_span;
+  using verona::cpp::cown_array;
+  using verona::cpp::cown_ptr;
+  using verona::cpp::make_cown;
+  using verona::cpp::when;
+
+  /*
+   * Sums keyed by 0 to keys - 1 (for example the balance of each branch of a bank) and their
+   * total, maintained from deltas so they can be read without acquiring what they summarise.
+   *
+   * - Behaviours that change the summarised values publish the deltas, publish spawns one
+   *   behaviour on a shard cown chosen by the publishing worker, so publishers rarely contend.
+   * - A publish carries at most max_deltas deltas, held inline in its behaviour.
+   * - All the deltas of one publish are applied to the same shard in one behaviour, deltas that
+   *   cancel (a transfer between two branches) never make a shard's total wrong.
+   * - read combines the shards hierarchically: each group of fanout shards is read in one
+   *   behaviour, in parallel with the other groups, and the partial sums are added on a cown
+   *   for that read.  It costs O(shards * keys) and never waits for the summarised cowns.
+   * - A delta is applied after the behaviour that published it, so a read reflects every
+   *   publish that happens before the read was spawned and possibly some later ones.
+   */
+  class Aggregate
+  {
+  public:
+    struct Delta
+    {
+      size_t key;
+      int64_t value;
+    };
+
+    struct Totals
+    {
+      int64_t total = 0;
+      std::vector<int64_t> keys;
+    };
+
+    static constexpr size_t max_deltas = 4;
+
+  private:
+    struct Shard
+    {
+      std::vector<int64_t> sums;
+
+      Shard(std::vector<int64_t> sums): sums(std::move(sums)) {}
+    };
+
+    struct Read
+    {
+      Totals totals;
+      size_t remaining;
+      std::function<void(const Totals&)> done;
+    };
+
+    const size_t keys;
+    const size_t fanout;
+    std::vector<cown_ptr<Shard>> shards;
+
+    static size_t worker() {
+      static std::atomic<size_t> next{0};
+      thread_local size_t index = next++;
+      return index;
+    }
+
+  public:
+    /*
+     * initial holds the starting sum of each key.
+     */
+    Aggregate(std::vector<int64_t> initial, size_t num_shards, size_t fanout = 16)
+    : keys(initial.size()), fanout(std::max<size_t>(fanout, 1)) {
+      shards.push_back(make_cown<Shard>(std::move(initial)));
+      for (size_t i = 1; i < std::max<size_t>(num_shards, 1); ++i)
+        shards.push_back(make_cown<Shard>(std::vector<int64_t>(keys, 0)));
+    }
+
+    Aggregate(const Aggregate&) = delete;
+
+    size_t size() const { return shards.size(); }
+
+    void publish(std::initializer_list<Delta> deltas) {
+      if (deltas.size() > max_deltas)
+        throw std::invalid_argument("publish of " + std::to_string(deltas.size()) + " deltas, at most " + std::to_string(max_deltas) + " are supported");
+      std::array<Delta, max_deltas> d;
+      size_t n = deltas.size();
+      std::copy(deltas.begin(), deltas.end(), d.begin());
+
+      when(shards[worker() % shards.size()]) << [d, n](acquired_cown<Shard> shard) {
+        for (size_t i = 0; i < n; ++i)
+          shard->sums[d[i].key] += d[i].value;
+      };
+    }
+
+    /*
+     * Calls f with the totals from a behaviour.
+     */
+    template<typename F>
+    void read(F f) {
+      size_t groups = (shards.size() + fanout - 1) / fanout;
+      auto result = make_cown<Read>(Read{Totals{0, std::vector<int64_t>(keys, 0)}, groups, std::move(f)});
+
+      for (size_t from = 0; from < shards.size(); from += fanout) {
+        size_t n = std::min(fanout, shards.size() - from);
+        when(verona::cpp::read(cown_array<Shard>(shards.data() + from, n))) << [result, keys = keys](acquired_cown_span<const Shard> group) {
+          std::vector<int64_t> partial(keys, 0);
+          for (auto& shard : group)
+            for (size_t k = 0; k < keys; ++k)
+              partial[k] += shard->sums[k];
+
+          when(result) << [partial = std::move(partial)](acquired_cown<Read> r) {
+            for (size_t k = 0; k < partial.size(); ++k)
+              r->totals.keys[k] += partial[k];
+            if (--r->remaining > 0)
+              return;
+            for (auto sum : r->totals.keys)
+              r->totals.total += sum;
+            r->done(r->totals);
+          };
+        };
+      }
+    }
+  };
+}
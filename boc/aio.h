@@ -0,0 +1,323 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+#include <cpp/when.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define BOC_AIO_URING
+#endif
+
+namespace boc::aio
+{
+  /*
+   * Asynchronous file reads and writes whose completion is a behaviour.
+   *
+   * - read and write are called from a behaviour (or any thread), they return at once and
+   *   the I/O runs without a worker waiting for it.  When it completes, then is called in a
+   *   behaviour on the target cown with the result and the buffer.
+   * - The Engine uses io_uring, through the system calls so liburing is not needed, and falls
+   *   back to a pool of threads doing blocking pread/pwrite when io_uring is not available
+   *   (old kernels, seccomp) or when asked to.
+   * - Completions are reaped, or the blocking calls made, by threads the caller provides by
+   *   calling serve from each of them, threads() of them (harness.external_thread in the
+   *   examples).  serve returns once close has been called and every request has completed.
+   * - The Engine registers an external event source with the runtime while it is open, so the
+   *   runtime does not finish while I/O is outstanding.
+   * - At most depth requests are in flight in the ring, more wait in a backlog and are
+   *   submitted as others complete.
+   */
+
+  struct Result
+  {
+    // bytes transferred, or -errno
+    ssize_t result;
+    std::vector<char> buffer;
+  };
+
+  class Engine
+  {
+  public:
+    enum class Backend { uring, threads };
+
+  private:
+    struct Request
+    {
+      int fd;
+      off_t offset;
+      bool write;
+      std::vector<char> buffer;
+      iovec iov;
+      std::function<void(Result)> complete;
+    };
+
+    Backend kind = Backend::threads;
+    const size_t depth;
+    const size_t pool;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<Request*> backlog;
+    size_t in_flight = 0;
+    bool closing = false;
+    std::atomic<size_t> outstanding{0};
+    std::atomic<size_t> serving{0};
+
+#ifdef BOC_AIO_URING
+    int ring = -1;
+    void* sq_ptr = nullptr;
+    size_t sq_len = 0;
+    void* cq_ptr = nullptr;
+    size_t cq_len = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_len = 0;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    bool setup_uring() {
+      io_uring_params p;
+      memset(&p, 0, sizeof(p));
+      int fd = int(syscall(__NR_io_uring_setup, unsigned(depth), &p));
+      if (fd < 0)
+        return false;
+
+      sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+      bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+      if (single)
+        sq_len = cq_len = std::max(sq_len, cq_len);
+      sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      cq_ptr = single ? sq_ptr : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+      void* s = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+      if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || s == MAP_FAILED) {
+        ::close(fd);
+        return false;
+      }
+      sqes = static_cast<io_uring_sqe*>(s);
+
+      char* sq = static_cast<char*>(sq_ptr);
+      char* cq = static_cast<char*>(cq_ptr);
+      sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+      sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+      sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+      cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+      cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+      cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+      cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+      ring = fd;
+      return true;
+    }
+
+    // called holding lock, a null request is the wake up sent by close
+    void submit_uring(Request* r) {
+      unsigned tail = *sq_tail;
+      unsigned index = tail & *sq_mask;
+      io_uring_sqe* sqe = &sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      if (r == nullptr) {
+        sqe->opcode = IORING_OP_NOP;
+      } else {
+        sqe->opcode = r->write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = r->fd;
+        sqe->off = uint64_t(r->offset);
+        sqe->addr = uint64_t(reinterpret_cast<uintptr_t>(&r->iov));
+        sqe->len = 1;
+      }
+      sqe->user_data = uint64_t(reinterpret_cast<uintptr_t>(r));
+      sq_array[index] = index;
+      __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+      while (syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0) < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        // the ring is unusable, fail the request rather than lose it
+        int error = errno;
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        if (r != nullptr)
+          finish(r, -error);
+        return;
+      }
+      in_flight++;
+    }
+
+    void serve_uring() {
+      for (;;) {
+        syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+        std::vector<std::pair<Request*, int>> done;
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        bool woken = false;
+        for (; head != tail; ++head) {
+          io_uring_cqe* cqe = &cqes[head & *cq_mask];
+          auto r = reinterpret_cast<Request*>(uintptr_t(cqe->user_data));
+          if (r == nullptr)
+            woken = true;
+          else
+            done.emplace_back(r, cqe->res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        bool finished;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          in_flight -= done.size() + woken;
+          while (!backlog.empty() && in_flight < depth) {
+            submit_uring(backlog.front());
+            backlog.pop_front();
+          }
+          finished = closing && outstanding == done.size() && backlog.empty();
+        }
+        for (auto& [r, res] : done)
+          finish(r, res);
+        if (finished)
+          return;
+      }
+    }
+#endif
+
+    void finish(Request* r, ssize_t res) {
+      r->complete(Result{res, std::move(r->buffer)});
+      delete r;
+      outstanding--;
+    }
+
+    void serve_threads() {
+      for (;;) {
+        Request* r;
+        {
+          std::unique_lock<std::mutex> guard(lock);
+          ready.wait(guard, [this]() { return !backlog.empty() || (closing && outstanding == 0); });
+          if (backlog.empty())
+            return;
+          r = backlog.front();
+          backlog.pop_front();
+        }
+        ssize_t n = r->write ? pwrite(r->fd, r->buffer.data(), r->buffer.size(), r->offset)
+                             : pread(r->fd, r->buffer.data(), r->buffer.size(), r->offset);
+        finish(r, n < 0 ? -errno : n);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (closing && outstanding == 0)
+          ready.notify_all();
+      }
+    }
+
+    template<typename T, typename F>
+    void submit(int fd, off_t offset, bool write, std::vector<char> buffer, verona::cpp::cown_ptr<T> target, F then) {
+      auto r = new Request{fd, offset, write, std::move(buffer), {}, {}};
+      r->iov = iovec{r->buffer.data(), r->buffer.size()};
+      r->complete = [target = std::move(target), then = std::move(then)](Result result) mutable {
+        verona::cpp::when(target) << [then = std::move(then), result = std::move(result)](verona::cpp::acquired_cown<T> t) mutable {
+          then(t, std::move(result));
+        };
+      };
+      outstanding++;
+
+      std::lock_guard<std::mutex> guard(lock);
+#ifdef BOC_AIO_URING
+      if (kind == Backend::uring) {
+        if (in_flight < depth)
+          submit_uring(r);
+        else
+          backlog.push_back(r);
+        return;
+      }
+#endif
+      backlog.push_back(r);
+      ready.notify_one();
+    }
+
+  public:
+    /*
+     * depth bounds the requests in the ring, pool is the number of threads of the fallback.
+     */
+    Engine(size_t depth = 256, size_t pool = 8, Backend backend = Backend::uring)
+    : depth(std::max<size_t>(depth, 1)), pool(std::max<size_t>(pool, 1)) {
+#ifdef BOC_AIO_URING
+      if (backend == Backend::uring && setup_uring())
+        kind = Backend::uring;
+#endif
+      verona::rt::Scheduler::add_external_event_source();
+    }
+
+    Engine(const Engine&) = delete;
+
+    ~Engine() {
+#ifdef BOC_AIO_URING
+      if (ring >= 0) {
+        munmap(sqes, sqes_len);
+        if (cq_ptr != sq_ptr)
+          munmap(cq_ptr, cq_len);
+        munmap(sq_ptr, sq_len);
+        ::close(ring);
+      }
+#endif
+    }
+
+    Backend backend() const { return kind; }
+
+    const char* name() const { return kind == Backend::uring ? "io_uring" : "threads"; }
+
+    // the number of threads that should call serve
+    size_t threads() const { return kind == Backend::uring ? 1 : pool; }
+
+    /*
+     * Reads length bytes at offset, then(acquired_cown<T>&, Result) runs on target with them.
+     */
+    template<typename T, typename F>
+    void read(int fd, off_t offset, size_t length, verona::cpp::cown_ptr<T> target, F then) {
+      submit(fd, offset, false, std::vector<char>(length), std::move(target), std::move(then));
+    }
+
+    template<typename T, typename F>
+    void write(int fd, off_t offset, std::vector<char> data, verona::cpp::cown_ptr<T> target, F then) {
+      submit(fd, offset, true, std::move(data), std::move(target), std::move(then));
+    }
+
+    void serve() {
+#ifdef BOC_AIO_URING
+      if (kind == Backend::uring)
+        serve_uring();
+      else
+#endif
+        serve_threads();
+
+      if (++serving == threads())
+        verona::rt::Scheduler::remove_external_event_source();
+    }
+
+    /*
+     * No more requests may be made, serve returns once the outstanding ones complete.
+     */
+    void close() {
+      std::lock_guard<std::mutex> guard(lock);
+      closing = true;
+#ifdef BOC_AIO_URING
+      if (kind == Backend::uring) {
+        submit_uring(nullptr);
+        return;
+      }
+#endif
+      ready.notify_all();
+    }
+  };
+}
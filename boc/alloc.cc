@@ -0,0 +1,264 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <boc/alloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace boc::alloc
+{
+  namespace
+  {
+    /*
+     * Every allocation is prefixed by a header recording its size and the distance back to
+     * the start of the underlying malloc block, so delete can account for it without a
+     * lookup.  The header is 16 bytes so default alignment is preserved.
+     */
+    struct Header
+    {
+      size_t size;
+      size_t offset;
+    };
+    static_assert(sizeof(Header) == 16);
+
+    std::atomic<size_t> count{0};
+    std::atomic<size_t> bytes{0};
+    std::atomic<size_t> live{0};
+    std::atomic<size_t> peak{0};
+
+    /*
+     * Call sites live in a fixed size open addressed table so recording one never allocates,
+     * sites that do not fit are counted as dropped.
+     */
+    constexpr size_t depth = 8;
+    constexpr size_t shown = 4;
+    constexpr size_t max_skip = 8;
+    constexpr size_t max_sites = 4096;
+
+    // a site being claimed, keys are odd so it is never a key
+    constexpr uint64_t busy = 2;
+
+    struct Site
+    {
+      std::atomic<uint64_t> key{0};
+      void* frames[depth];
+      std::atomic<size_t> count{0};
+      std::atomic<size_t> bytes{0};
+    };
+
+    Site sites[max_sites];
+    std::atomic<size_t> dropped{0};
+
+    thread_local bool in_tracker = false;
+
+    /*
+     * caller is the return address of operator new, the frames inside this file are skipped
+     * by finding it in the backtrace.
+     */
+    void record_site(size_t size, void* caller)
+    {
+      void* stack[depth + max_skip];
+      size_t n = size_t(backtrace(stack, int(depth + max_skip)));
+      size_t first = 0;
+      while (first < n && stack[first] != caller)
+        first++;
+      if (first == n) {
+        stack[0] = caller;
+        first = 0;
+        n = 1;
+      }
+      void** frames = stack + first;
+      size_t frame_count = std::min(depth, n - first);
+
+      uint64_t key = 14695981039346656037ull;
+      for (size_t i = 0; i < frame_count; ++i)
+        key = (key ^ uint64_t(uintptr_t(frames[i]))) * 1099511628211ull;
+      key |= 1;
+
+      for (size_t probe = 0; probe < max_sites; ++probe) {
+        Site& s = sites[(key + probe) % max_sites];
+        uint64_t k = s.key.load(std::memory_order_acquire);
+        // the site is claimed before its frames are written and its key published after, so
+        // only the claiming thread writes the frames and readers see them complete
+        if (k == 0 && s.key.compare_exchange_strong(k, busy, std::memory_order_acquire)) {
+          std::memcpy(s.frames, frames, frame_count * sizeof(void*));
+          s.key.store(key, std::memory_order_release);
+          k = key;
+        }
+        while (k == busy)
+          k = s.key.load(std::memory_order_acquire);
+        if (k == key) {
+          s.count.fetch_add(1, std::memory_order_relaxed);
+          s.bytes.fetch_add(size, std::memory_order_relaxed);
+          return;
+        }
+      }
+      dropped++;
+    }
+
+    void on_alloc(size_t size, void* caller)
+    {
+      count.fetch_add(1, std::memory_order_relaxed);
+      bytes.fetch_add(size, std::memory_order_relaxed);
+      size_t l = live.fetch_add(size, std::memory_order_relaxed) + size;
+      size_t p = peak.load(std::memory_order_relaxed);
+      while (l > p && !peak.compare_exchange_weak(p, l, std::memory_order_relaxed)) {}
+
+      // backtrace may allocate the first time it is called
+      if (!in_tracker) {
+        in_tracker = true;
+        record_site(size, caller);
+        in_tracker = false;
+      }
+    }
+
+    void* allocate(size_t size, size_t align, void* caller)
+    {
+      size_t offset = std::max(align, sizeof(Header));
+      void* base = align > alignof(std::max_align_t) ?
+        std::aligned_alloc(align, (size + offset + align - 1) / align * align) :
+        std::malloc(size + offset);
+      if (!base)
+        return nullptr;
+
+      char* p = static_cast<char*>(base) + offset;
+      Header* h = reinterpret_cast<Header*>(p) - 1;
+      h->size = size;
+      h->offset = offset;
+      on_alloc(size, caller);
+      return p;
+    }
+
+    void deallocate(void* p)
+    {
+      if (!p)
+        return;
+      Header* h = static_cast<Header*>(p) - 1;
+      live.fetch_sub(h->size, std::memory_order_relaxed);
+      std::free(static_cast<char*>(p) - h->offset);
+    }
+
+    void* allocate_or_throw(size_t size, size_t align, void* caller)
+    {
+      void* p = allocate(size, align, caller);
+      if (!p)
+        throw std::bad_alloc();
+      return p;
+    }
+
+    std::string symbol(void* frame)
+    {
+      char** names = backtrace_symbols(&frame, 1);
+      if (!names)
+        return "?";
+      std::string name = names[0];
+      std::free(names);
+
+      // binary(mangled+offset) [address]
+      size_t open = name.find('('), plus = name.find('+', open);
+      if (open == std::string::npos || plus == std::string::npos || plus == open + 1)
+        return name;
+      std::string mangled = name.substr(open + 1, plus - open - 1);
+      int status;
+      char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+      if (status != 0)
+        return mangled;
+      std::string result = demangled;
+      std::free(demangled);
+      return result;
+    }
+
+    /*
+     * Prints the totals and top call sites when the process exits.
+     */
+    struct ExitReport
+    {
+      ~ExitReport()
+      {
+        const char* env = std::getenv("BOC_ALLOC_TOP");
+        size_t top = env ? size_t(std::strtoul(env, nullptr, 10)) : 10;
+        Stats s = stats();
+        std::cerr << "Allocations: " << s.count << ", bytes: " << s.bytes << ", peak live bytes: " << s.peak_live_bytes << std::endl;
+
+        report_sites(std::cerr, top);
+        if (dropped)
+          std::cerr << dropped << " allocations from call sites that did not fit in the table" << std::endl;
+      }
+    } exit_report;
+  }
+
+  Stats stats()
+  {
+    return Stats{count, bytes, live, peak};
+  }
+
+  void reset()
+  {
+    count = 0;
+    bytes = 0;
+    peak = live.load();
+  }
+
+  void report_sites(std::ostream& out, size_t top)
+  {
+    in_tracker = true;
+    std::vector<Site*> sorted;
+    for (auto& site : sites)
+      if (site.key.load(std::memory_order_acquire) & 1)
+        sorted.push_back(&site);
+    std::sort(sorted.begin(), sorted.end(), [](Site* a, Site* b) { return a->bytes > b->bytes; });
+    for (size_t i = 0; i < std::min(top, sorted.size()); ++i) {
+      out << sorted[i]->bytes << " bytes in " << sorted[i]->count << " allocations" << std::endl;
+
+      // standard library frames are only shown if there is nothing else to show
+      std::vector<std::string> names, user;
+      for (size_t f = 0; f < depth && sorted[i]->frames[f]; ++f) {
+        names.push_back(symbol(sorted[i]->frames[f]));
+        if (names.back().rfind("std::", 0) != 0 && names.back().rfind("__gnu_cxx::", 0) != 0)
+          user.push_back(names.back());
+      }
+      auto& frames = user.empty() ? names : user;
+      for (size_t f = 0; f < std::min(shown, frames.size()); ++f)
+        out << "    " << frames[f] << std::endl;
+    }
+    in_tracker = false;
+  }
+}
+
+using boc::alloc::allocate;
+using boc::alloc::allocate_or_throw;
+using boc::alloc::deallocate;
+
+#define CALLER __builtin_return_address(0)
+
+void* operator new(size_t size) { return allocate_or_throw(size, alignof(std::max_align_t), CALLER); }
+void* operator new[](size_t size) { return allocate_or_throw(size, alignof(std::max_align_t), CALLER); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, alignof(std::max_align_t), CALLER); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, alignof(std::max_align_t), CALLER); }
+void* operator new(size_t size, std::align_val_t align) { return allocate_or_throw(size, size_t(align), CALLER); }
+void* operator new[](size_t size, std::align_val_t align) { return allocate_or_throw(size, size_t(align), CALLER); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return allocate(size, size_t(align), CALLER); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return allocate(size, size_t(align), CALLER); }
+
+#undef CALLER
+
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(p); }
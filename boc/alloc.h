@@ -0,0 +1,50 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+
+namespace boc::alloc
+{
+  /*
+   * Heap allocation accounting for the examples.
+   *
+   * - Configuring with -DBOC_ALLOC_TRACKING=ON links boc/alloc.cc into every example, it
+   *   replaces the global operator new and delete to count allocations, bytes allocated and
+   *   the peak number of live bytes, and to attribute allocations to call sites.
+   * - Counts are since the last reset, boc::timed_run resets before each run and boc::Report
+   *   appends the counts to every result line.
+   * - A call site is the first few frames of the stack above operator new, so allocations made
+   *   through std::function, std::make_unique, etc. are attributed to the code using them.
+   * - When the process exits the counts since the last reset and the BOC_ALLOC_TOP (default 10) call sites with the
+   *   most bytes allocated are printed to stderr.
+   * - Without BOC_ALLOC_TRACKING these functions do nothing and cost nothing.
+   */
+
+  struct Stats
+  {
+    size_t count;
+    size_t bytes;
+    size_t live_bytes;
+    size_t peak_live_bytes;
+  };
+
+#ifdef BOC_ALLOC_TRACKING
+  constexpr bool enabled = true;
+
+  Stats stats();
+
+  void reset();
+
+  void report_sites(std::ostream& out, size_t top);
+#else
+  constexpr bool enabled = false;
+
+  inline Stats stats() { return Stats{0, 0, 0, 0}; }
+
+  inline void reset() {}
+
+  inline void report_sites(std::ostream&, size_t) {}
+#endif
+}
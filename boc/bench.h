@@ -0,0 +1,66 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <sys/resource.h>
+#include <debug/harness.h>
+#include <boc/alloc.h>
+
+namespace boc
+{
+  /*
+   * Shared helpers for the benchmark modes of the examples.
+   *
+   * - Every measurement is reported as one line on stdout of the form
+   *     result,<key>=<value>,<key>=<value>,...
+   *   so that scripts can pick the results out of the rest of the output.
+   * - timed_run wraps harness.run and returns the wall clock time in seconds,
+   *   this includes runtime start up and tear down.
+   * - When allocation tracking is built in (boc/alloc.h) timed_run resets the allocation
+   *   counts and every Report line ends with the counts for the run.
+   * - peak_rss_kb is the high water mark of the whole process, so runs that are compared by
+   *   it need to be separate processes.
+   */
+  class Report
+  {
+    std::ostringstream line;
+
+  public:
+    Report() { line << "result"; }
+
+    template<typename T>
+    Report& operator()(const char* key, const T& value)
+    {
+      line << "," << key << "=" << value;
+      return *this;
+    }
+
+    ~Report() {
+      if (alloc::enabled) {
+        alloc::Stats s = alloc::stats();
+        (*this)("allocs", s.count)("alloc_bytes", s.bytes)("peak_live_bytes", s.peak_live_bytes);
+      }
+      std::cout << line.str() << std::endl;
+    }
+  };
+
+  template<typename... Params, typename... Args>
+  double timed_run(SystematicTestHarness& harness, void f(Params...), Args&&... args)
+  {
+    alloc::reset();
+    auto start = std::chrono::steady_clock::now();
+    harness.run(f, Params(std::forward<Args>(args))...);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+  }
+
+  inline size_t peak_rss_kb()
+  {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return size_t(usage.ru_maxrss);
+  }
+}
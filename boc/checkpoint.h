@@ -0,0 +1,323 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc::checkpoint
+{
+  using verona::cpp::acquired_cown_span;
+  using verona::cpp::cown_array;
+  using verona::cpp::cown_ptr;
+  using verona::cpp::make_cown;
+  using verona::cpp::when;
+
+  /*
+   * Checkpoints of an array of cowns to a memory-mapped file, and restart from one.
+   *
+   * - A checkpoint file is a Header followed by the value of cown i at offset
+   *   sizeof(Header) + i * sizeof(T), so T must be trivially copyable.
+   * - Writer::take copies the cowns a range at a time, each range is one behaviour over its
+   *   cowns and spawns the next range when it finishes, so the rest of the program keeps
+   *   running while a checkpoint is taken.
+   * - The copy is of a single cut even though ranges are copied at different times.  Taking
+   *   a checkpoint starts a new epoch, a behaviour that writes cown i reads epoch() once when
+   *   it starts and calls preserve(epoch, i, value) before changing the value.  A behaviour
+   *   that reads the new epoch saves the value it is about to overwrite, unless the range
+   *   holding i has already been copied, and the range then skips i.  Epochs only increase
+   *   and each cown's behaviours run one after the other, so every behaviour that read the
+   *   old epoch is before every one that read the new epoch on the cowns they share.
+   * - The checkpoint is written to path.tmp and renamed over path once it is synced, so path
+   *   always holds the previous complete checkpoint.
+   * - take and the behaviours of a checkpoint never throw: a checkpoint that cannot be written
+   *   is cleaned up (the mapping and path.tmp removed) and its error passed to done.  Only
+   *   Image, which is opened from the main thread, throws.
+   * - Image maps a checkpoint read only, and Cowns creates the cown for an index from the
+   *   image the first time it is asked for, so a restart does not wait for every cown.
+   */
+
+  struct Header
+  {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t epoch;
+    uint64_t complete;
+    uint64_t padding[3];
+  };
+
+  static_assert(sizeof(Header) == 64);
+
+  static constexpr uint64_t magic = 0xb0c1c4ec00000000ull;
+  static constexpr uint32_t version = 1;
+
+  template<typename T>
+  class Writer
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    struct Pass
+    {
+      std::string path;
+      std::string tmp;
+      char* base = nullptr;
+      size_t size;
+      uint64_t epoch;
+      size_t range;
+      std::function<cown_ptr<T>(size_t)> get;
+      std::function<void(std::optional<std::string>)> done;
+    };
+
+    const size_t count;
+    // saved[i] is the epoch in which cown i was last copied, only accessed holding cown i
+    std::unique_ptr<uint64_t[]> saved;
+    std::atomic<uint64_t> current{0};
+    std::atomic<T*> slots{nullptr};
+    std::atomic<bool> running{false};
+
+  public:
+    Writer(size_t count): count(count) {}
+
+    Writer(const Writer&) = delete;
+
+    uint64_t epoch() const { return current.load(std::memory_order_acquire); }
+
+    /*
+     * Must be called holding cown index, with the epoch read at the start of the behaviour,
+     * before the behaviour changes the cown's value.
+     */
+    void preserve(uint64_t epoch, size_t index, const T& value) {
+      if (epoch == 0 || saved[index] == epoch)
+        return;
+      slots.load(std::memory_order_relaxed)[index] = value;
+      saved[index] = epoch;
+    }
+
+    /*
+     * Checkpoints cowns get(0) to get(count - 1) to path, range cowns at a time, and calls
+     * done(std::nullopt) once path holds the checkpoint, or done(error) if it could not be
+     * written.  Only one checkpoint can be in progress, and the Writer must outlive it.
+     */
+    template<typename Get, typename Done>
+    void take(const std::string& path, size_t range, Get get, Done done) {
+      if (running.exchange(true))
+        return done(std::string("checkpoint already in progress"));
+
+      auto pass = std::make_shared<Pass>();
+      pass->path = path;
+      pass->tmp = path + ".tmp";
+      pass->size = sizeof(Header) + count * sizeof(T);
+      pass->range = std::max<size_t>(range, 1);
+      pass->get = std::move(get);
+      pass->done = std::move(done);
+
+      int fd = open(pass->tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+        return fail(pass, "cannot open checkpoint " + pass->tmp + ": " + strerror(errno));
+      if (ftruncate(fd, off_t(pass->size)) != 0) {
+        int error = errno;
+        close(fd);
+        return fail(pass, std::string("cannot size checkpoint: ") + strerror(error));
+      }
+      void* base = mmap(nullptr, pass->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      int error = errno;
+      close(fd);
+      if (base == MAP_FAILED)
+        return fail(pass, std::string("cannot map checkpoint: ") + strerror(error));
+      pass->base = static_cast<char*>(base);
+
+      if (!saved)
+        saved.reset(new uint64_t[count]());
+
+      pass->epoch = current.load() + 1;
+      auto header = reinterpret_cast<Header*>(pass->base);
+      *header = Header{magic, version, uint32_t(sizeof(T)), count, pass->epoch, 0, {}};
+
+      slots.store(reinterpret_cast<T*>(pass->base + sizeof(Header)), std::memory_order_relaxed);
+      current.store(pass->epoch, std::memory_order_release);
+
+      copy(pass, 0);
+    }
+
+  private:
+    void copy(std::shared_ptr<Pass> pass, size_t from) {
+      if (from == count) {
+        verona::rt::schedule_lambda([this, pass]() { finish(pass); });
+        return;
+      }
+
+      size_t to = std::min(from + pass->range, count);
+      auto cowns = std::make_shared<std::vector<cown_ptr<T>>>();
+      cowns->reserve(to - from);
+      for (size_t i = from; i < to; ++i)
+        cowns->push_back(pass->get(i));
+
+      when(cown_array<T>(cowns->data(), cowns->size())) << [this, pass, from, to, cowns](acquired_cown_span<T> range) {
+        T* out = slots.load(std::memory_order_relaxed);
+        for (size_t i = from; i < to; ++i) {
+          if (saved[i] == pass->epoch)
+            continue;
+          out[i] = *range[i - from];
+          saved[i] = pass->epoch;
+        }
+        copy(pass, to);
+      };
+    }
+
+    // every cown has been copied, so no behaviour writes to the mapping once it is unmapped
+    void finish(std::shared_ptr<Pass> pass) {
+      auto header = reinterpret_cast<Header*>(pass->base);
+      if (msync(pass->base, pass->size, MS_SYNC) != 0)
+        return fail(pass, std::string("checkpoint msync failed: ") + strerror(errno));
+      header->complete = 1;
+      if (msync(pass->base, sizeof(Header), MS_SYNC) != 0)
+        return fail(pass, std::string("checkpoint msync failed: ") + strerror(errno));
+      munmap(pass->base, pass->size);
+      pass->base = nullptr;
+      if (rename(pass->tmp.c_str(), pass->path.c_str()) != 0)
+        return fail(pass, "cannot rename checkpoint to " + pass->path + ": " + strerror(errno));
+
+      running = false;
+      pass->done(std::nullopt);
+    }
+
+    // removes what the pass created, path is left as it was
+    void fail(std::shared_ptr<Pass> pass, std::string error) {
+      if (pass->base)
+        munmap(pass->base, pass->size);
+      pass->base = nullptr;
+      unlink(pass->tmp.c_str());
+      running = false;
+      pass->done(std::move(error));
+    }
+  };
+
+  /*
+   * A complete checkpoint mapped read only.
+   */
+  template<typename T>
+  class Image
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    char* base;
+    size_t length;
+    const Header* header;
+    const T* records;
+
+  public:
+    explicit Image(const std::string& path) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+        throw std::runtime_error("cannot open checkpoint " + path + ": " + strerror(errno));
+      struct stat st;
+      if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error("checkpoint " + path + " is truncated");
+      }
+      length = size_t(st.st_size);
+      void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (p == MAP_FAILED)
+        throw std::runtime_error(std::string("cannot map checkpoint: ") + strerror(errno));
+      base = static_cast<char*>(p);
+      header = reinterpret_cast<const Header*>(base);
+      records = reinterpret_cast<const T*>(base + sizeof(Header));
+
+      if (header->magic != magic || header->version != version || header->record_size != sizeof(T)
+        || header->complete != 1 || length != sizeof(Header) + header->count * sizeof(T)) {
+        munmap(base, length);
+        throw std::runtime_error("checkpoint " + path + " is incomplete or has a different layout");
+      }
+      // cowns are created in whatever order they are first used
+      madvise(base, length, MADV_RANDOM);
+    }
+
+    Image(const Image&) = delete;
+
+    ~Image() { munmap(base, length); }
+
+    size_t size() const { return header->count; }
+
+    uint64_t epoch() const { return header->epoch; }
+
+    const T& operator[](size_t i) const { return records[i]; }
+  };
+
+  /*
+   * The cowns of an Image, each created from its record the first time it is asked for.
+   * The slots are anonymous memory so the pages for cowns that are never used are never
+   * touched.  Cowns must be destroyed before the runtime finishes.
+   */
+  template<typename T>
+  class Cowns
+  {
+    enum : uint8_t { empty, creating, ready };
+
+    const Image<T>& image;
+    size_t length;
+    void* memory;
+    std::atomic<uint8_t>* state;
+    cown_ptr<T>* cowns;
+    std::atomic<size_t> count{0};
+
+  public:
+    explicit Cowns(const Image<T>& image): image(image) {
+      size_t states = (image.size() + alignof(cown_ptr<T>) - 1) / alignof(cown_ptr<T>) * alignof(cown_ptr<T>);
+      length = states + image.size() * sizeof(cown_ptr<T>);
+      memory = mmap(nullptr, std::max<size_t>(length, 1), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory == MAP_FAILED)
+        throw std::bad_alloc();
+      state = static_cast<std::atomic<uint8_t>*>(memory);
+      cowns = reinterpret_cast<cown_ptr<T>*>(static_cast<char*>(memory) + states);
+    }
+
+    Cowns(const Cowns&) = delete;
+
+    ~Cowns() {
+      for (size_t i = 0; i < image.size(); ++i)
+        if (state[i].load(std::memory_order_relaxed) == ready)
+          cowns[i].~cown_ptr<T>();
+      munmap(memory, std::max<size_t>(length, 1));
+    }
+
+    size_t size() const { return image.size(); }
+
+    // the number of cowns created so far
+    size_t created() const { return count.load(std::memory_order_relaxed); }
+
+    cown_ptr<T> operator[](size_t i) {
+      if (state[i].load(std::memory_order_acquire) != ready) {
+        uint8_t expected = empty;
+        if (state[i].compare_exchange_strong(expected, creating, std::memory_order_acquire)) {
+          new (&cowns[i]) cown_ptr<T>(make_cown<T>(image[i]));
+          count.fetch_add(1, std::memory_order_relaxed);
+          state[i].store(ready, std::memory_order_release);
+        } else {
+          while (state[i].load(std::memory_order_acquire) != ready)
+            std::this_thread::yield();
+        }
+      }
+      return cowns[i];
+    }
+  };
+}
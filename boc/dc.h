@@ -0,0 +1,48 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <utility>
+#include <cpp/when.h>
+
+namespace boc::dc
+{
+  /*
+   * A divide and conquer skeleton, the pattern of Fib::parallel for any problem:
+   * - Ops describes the problem with the types Problem and Result and the operations
+   *     bool is_base(const Problem&)
+   *     Result base(Problem)
+   *     std::pair<Problem, Problem> split(Problem)
+   *     Result combine(Result&&, Result&&)
+   *   it is copied into every behaviour so it should only hold pointers and parameters.
+   * - solve splits the problem on the calling thread until is_base, each base case is a
+   *   behaviour writing its result to a new cown and each split is joined by a behaviour that
+   *   acquires the results of both halves and combines them into the cown of the left half.
+   * - Results are moved from the cowns of the halves into combine and its result is moved
+   *   into the left cown, a Result that owns a buffer is passed up without copying it.
+   * - The cown returned holds the result of the whole problem once the behaviours spawned on
+   *   it so far have run, so the caller reads it with a when.
+   */
+  template<typename Ops>
+  verona::cpp::cown_ptr<typename Ops::Result> solve(const Ops& ops, typename Ops::Problem problem)
+  {
+    using Result = typename Ops::Result;
+    using verona::cpp::acquired_cown;
+
+    if (ops.is_base(problem)) {
+      auto result = verona::cpp::make_cown<Result>();
+      verona::cpp::when(result) << [ops, problem = std::move(problem)](acquired_cown<Result> result) mutable {
+        *result = ops.base(std::move(problem));
+      };
+      return result;
+    }
+
+    auto halves = ops.split(std::move(problem));
+    auto left = solve(ops, std::move(halves.first));
+    auto right = solve(ops, std::move(halves.second));
+    verona::cpp::when(left, right) << [ops](acquired_cown<Result> left, acquired_cown<Result> right) {
+      *left = ops.combine(std::move(*left), std::move(*right));
+    };
+    return left;
+  }
+}
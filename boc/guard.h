@@ -0,0 +1,198 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc
+{
+  namespace detail
+  {
+    struct Waiter;
+
+    template<typename P, typename F, typename... T>
+    class Guard;
+  }
+
+  /*
+   * Guarded behaviours: when_if(pred, cowns...) << f runs f once pred holds over the cowns,
+   * instead of a behaviour that acquires them only to find there is nothing to do.
+   *
+   * - The types of the cowns derive from Guarded, which holds the guards waiting on the cown.
+   * - A guard is evaluated in a behaviour on all of its cowns.  If pred is false the guard
+   *   registers on each cown it is not registered on already and the behaviour ends, counted
+   *   as wasted in counters().
+   * - A writer that may have made a predicate true calls signal() on the cown, in its
+   *   behaviour.  This takes the guards registered on the cown and spawns an evaluation of
+   *   each, unless one is pending already, so the writes before an evaluation cost one
+   *   behaviour however many there are.
+   * - A guard registers while holding all its cowns and a signal is made holding one of them,
+   *   so a write between a failed evaluation and the registration cannot be missed.
+   * - whenever(pred, cowns...) << f stays registered after f has run: each evaluation runs f
+   *   for as long as pred holds, then waits again.
+   * - pred and f take the acquired cowns by reference.  A waiting guard holds its cowns
+   *   weakly and is dropped with them, but the cowns hold the guard, so the closures of
+   *   whenever must not hold the cowns.  when_if drops its closures once f has run.
+   */
+  class Guarded
+  {
+    template<typename P, typename F, typename... T>
+    friend class detail::Guard;
+
+    struct Registration
+    {
+      std::shared_ptr<detail::Waiter> waiter;
+      size_t index;
+    };
+
+    std::vector<Registration> waiting;
+
+  public:
+    struct Counters
+    {
+      // behaviours evaluating a guard
+      std::atomic<size_t> evaluations{0};
+      // evaluations that found the predicate false
+      std::atomic<size_t> wasted{0};
+      // calls of the guarded closures
+      std::atomic<size_t> dispatched{0};
+    };
+
+    static Counters& counters() {
+      static Counters c;
+      return c;
+    }
+
+    // wakes the guards waiting on this cown, from a behaviour holding it
+    void signal();
+
+    size_t waiters() const { return waiting.size(); }
+  };
+
+  namespace detail
+  {
+    struct Waiter
+    {
+      // an evaluation has been spawned and has not started, or a when_if has fired
+      std::atomic<bool> pending{true};
+      // registered[i] is only accessed holding the guard's i-th cown
+      std::vector<char> registered;
+
+      Waiter(size_t cowns): registered(cowns, 0) {}
+
+      virtual ~Waiter() = default;
+
+      virtual void evaluate(std::shared_ptr<Waiter> self) = 0;
+    };
+
+    template<typename P, typename F, typename... T>
+    class Guard : public Waiter
+    {
+      std::optional<P> pred;
+      std::optional<F> f;
+      const bool persistent;
+      std::tuple<typename verona::cpp::cown_ptr<T>::weak...> cowns;
+
+      template<size_t... I>
+      void wait(std::shared_ptr<Waiter> self, std::index_sequence<I...>, verona::cpp::acquired_cown<T>&... acquired) {
+        auto one = [&](size_t i, Guarded& g) {
+          if (!registered[i]) {
+            registered[i] = 1;
+            g.waiting.push_back(Guarded::Registration{self, i});
+          }
+        };
+        (one(I, *acquired), ...);
+      }
+
+      static void spawn(std::shared_ptr<Guard> self, verona::cpp::cown_ptr<T>... strong) {
+        verona::cpp::when(std::move(strong)...) << [self](verona::cpp::acquired_cown<T>... acquired) mutable {
+          auto& counters = Guarded::counters();
+          self->pending = false;
+          counters.evaluations++;
+          bool fired = false;
+          while ((*self->pred)(acquired...)) {
+            fired = true;
+            counters.dispatched++;
+            (*self->f)(acquired...);
+            if (!self->persistent) {
+              // never evaluated again, the registrations left are dropped by their signals
+              self->pending = true;
+              self->pred.reset();
+              self->f.reset();
+              return;
+            }
+          }
+          if (!fired)
+            counters.wasted++;
+          self->wait(self, std::index_sequence_for<T...>{}, acquired...);
+        };
+      }
+
+    public:
+      Guard(P pred, F f, bool persistent, verona::cpp::cown_ptr<T>... cs)
+      : Waiter(sizeof...(T)), pred(std::move(pred)), f(std::move(f)), persistent(persistent), cowns(cs.get_weak()...) {}
+
+      static void start(std::shared_ptr<Guard> self, verona::cpp::cown_ptr<T>... cs) { spawn(std::move(self), std::move(cs)...); }
+
+      void evaluate(std::shared_ptr<Waiter> self) override {
+        auto strong = std::apply([](auto&... w) { return std::make_tuple(w.promote()...); }, cowns);
+        // a cown has gone, so no write can wake this guard again
+        if (std::apply([](auto&... c) { return (!c || ...); }, strong))
+          return;
+        std::apply([&](auto&... c) { spawn(std::static_pointer_cast<Guard>(self), std::move(c)...); }, strong);
+      }
+    };
+
+    template<typename P, typename... T>
+    class GuardedWhen
+    {
+      static_assert((std::is_base_of_v<Guarded, T> && ...), "the cowns of a guarded behaviour must derive from boc::Guarded");
+
+      P pred;
+      const bool persistent;
+      std::tuple<verona::cpp::cown_ptr<T>...> cowns;
+
+    public:
+      GuardedWhen(P pred, bool persistent, verona::cpp::cown_ptr<T>... cs)
+      : pred(std::move(pred)), persistent(persistent), cowns(std::move(cs)...) {}
+
+      template<typename F>
+      void operator<<(F f) {
+        std::apply([&](auto&... c) {
+          auto g = std::make_shared<Guard<P, F, T...>>(std::move(pred), std::move(f), persistent, c...);
+          Guard<P, F, T...>::start(std::move(g), std::move(c)...);
+        }, cowns);
+      }
+    };
+  }
+
+  inline void Guarded::signal() {
+    if (waiting.empty())
+      return;
+    std::vector<Registration> woken;
+    woken.swap(waiting);
+    for (auto& r : woken) {
+      r.waiter->registered[r.index] = 0;
+      if (!r.waiter->pending.exchange(true))
+        r.waiter->evaluate(r.waiter);
+    }
+  }
+
+  // runs f once pred holds over the cowns
+  template<typename P, typename... T>
+  detail::GuardedWhen<P, T...> when_if(P pred, verona::cpp::cown_ptr<T>... cowns) {
+    return detail::GuardedWhen<P, T...>(std::move(pred), false, std::move(cowns)...);
+  }
+
+  // runs f every time pred holds over the cowns
+  template<typename P, typename... T>
+  detail::GuardedWhen<P, T...> whenever(P pred, verona::cpp::cown_ptr<T>... cowns) {
+    return detail::GuardedWhen<P, T...>(std::move(pred), true, std::move(cowns)...);
+  }
+}
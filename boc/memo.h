@@ -0,0 +1,179 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc
+{
+  /*
+   * A single-flight memo table for computations spread over behaviours, such as the
+   * sub-problems of a recursive parallel computation.
+   *
+   * - get(key, k) calls k with the value for key, computing it at most once however many
+   *   behaviours ask for it concurrently.
+   * - Keys are split over shard cowns.  The first get of a key records k in the key's slot
+   *   and calls compute(key, resolve) from a behaviour on the shard, later gets add their k
+   *   to the slot until the value is resolved, then every k in the slot is called with it.
+   * - compute runs holding the shard so it should only spawn the work, and call resolve once
+   *   the value is known, from any behaviour.
+   * - A resolved value is immutable, it is published in an insert-only open addressing table
+   *   of capacity slots that get reads without acquiring anything.  Once the table is full,
+   *   values are still found through their shard.
+   * - Continuations of a resolved key run on the thread calling get, those of a key being
+   *   computed run in the behaviour that delivers the value, so they should be short too.
+   */
+  template<typename K, typename V, typename Hash = std::hash<K>>
+  class Memo
+  {
+  public:
+    using Continuation = std::function<void(const V&)>;
+    using Resolve = std::function<void(V)>;
+    using Compute = std::function<void(const K&, Resolve)>;
+
+  private:
+    struct Node
+    {
+      K key;
+      V value;
+    };
+
+    struct Slot
+    {
+      const Node* node = nullptr;
+      std::vector<Continuation> waiters;
+    };
+
+    struct Shard
+    {
+      std::unordered_map<K, Slot, Hash> slots;
+      std::vector<std::unique_ptr<Node>> nodes;
+    };
+
+    Compute compute;
+    Hash hash;
+    std::vector<verona::cpp::cown_ptr<Shard>> shards;
+    size_t mask;
+    std::unique_ptr<std::atomic<const Node*>[]> table;
+
+    std::atomic<size_t> computed{0};
+    std::atomic<size_t> waited{0};
+    std::atomic<size_t> fast{0};
+    std::atomic<size_t> spawned{0};
+
+    const Node* find(const K& key, size_t h) const {
+      for (size_t i = 0; i <= mask; ++i) {
+        const Node* n = table[(h + i) & mask].load(std::memory_order_acquire);
+        if (n == nullptr)
+          return nullptr;
+        if (n->key == key)
+          return n;
+      }
+      return nullptr;
+    }
+
+    void publish(const Node* node, size_t h) {
+      for (size_t i = 0; i <= mask; ++i) {
+        const Node* expected = nullptr;
+        if (table[(h + i) & mask].compare_exchange_strong(expected, node, std::memory_order_release))
+          return;
+      }
+    }
+
+    // std::hash is the identity for integers, spread keys over the table and shards
+    size_t mix(const K& key) const {
+      uint64_t h = uint64_t(hash(key)) * 0x9e3779b97f4a7c15ull;
+      return size_t(h ^ (h >> 32));
+    }
+
+    verona::cpp::cown_ptr<Shard>& shard(size_t h) { return shards[(h >> 8) % shards.size()]; }
+
+    void resolve(K key, V value) {
+      size_t h = mix(key);
+      auto node = std::make_unique<Node>(Node{std::move(key), std::move(value)});
+      publish(node.get(), h);
+
+      spawned++;
+      verona::cpp::when(shard(h)) << [node = std::move(node)](verona::cpp::acquired_cown<Shard> shard) mutable {
+        const Node* n = node.get();
+        Slot& slot = shard->slots[n->key];
+        slot.node = n;
+        auto waiters = std::move(slot.waiters);
+        shard->nodes.push_back(std::move(node));
+        for (auto& k : waiters)
+          k(n->value);
+      };
+    }
+
+  public:
+    /*
+     * capacity is the number of values the lock free table can hold, it is rounded up to a
+     * power of two at least twice as large.
+     */
+    Memo(Compute compute, size_t capacity, size_t num_shards = 64)
+    : compute(std::move(compute)) {
+      size_t size = 2;
+      while (size < 2 * capacity)
+        size *= 2;
+      mask = size - 1;
+      table.reset(new std::atomic<const Node*>[size]);
+      for (size_t i = 0; i < size; ++i)
+        table[i].store(nullptr, std::memory_order_relaxed);
+      for (size_t i = 0; i < std::max<size_t>(num_shards, 1); ++i)
+        shards.push_back(verona::cpp::make_cown<Shard>());
+    }
+
+    Memo(const Memo&) = delete;
+
+    void get(const K& key, Continuation k) {
+      size_t h = mix(key);
+      if (const Node* n = find(key, h)) {
+        fast++;
+        return k(n->value);
+      }
+
+      spawned++;
+      verona::cpp::when(shard(h)) << [this, key, k = std::move(k)](verona::cpp::acquired_cown<Shard> shard) mutable {
+        auto [it, fresh] = shard->slots.try_emplace(key);
+        if (it->second.node)
+          return k(it->second.node->value);
+        it->second.waiters.push_back(std::move(k));
+        if (!fresh) {
+          waited++;
+          return;
+        }
+        computed++;
+        compute(key, [this, key](V value) { resolve(key, std::move(value)); });
+      };
+    }
+
+    /*
+     * Calls f from a behaviour once every behaviour spawned on the shards so far has run,
+     * the Memo can be destroyed from f if nothing else uses it.
+     */
+    template<typename F>
+    void drain(F f) {
+      verona::cpp::when(verona::cpp::cown_array<Shard>(shards.data(), shards.size())) <<
+        [f = std::move(f)](verona::cpp::acquired_cown_span<Shard>) mutable { f(); };
+    }
+
+    // keys computed
+    size_t computations() const { return computed; }
+
+    // gets that attached to a computation in progress
+    size_t waits() const { return waited; }
+
+    // gets answered from the lock free table
+    size_t hits() const { return fast; }
+
+    // behaviours spawned by gets and resolves
+    size_t behaviours() const { return spawned; }
+  };
+}
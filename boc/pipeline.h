@@ -0,0 +1,237 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc::pipeline
+{
+  /*
+   * Stream processing stages over cowns:
+   *
+   *   auto source = boc::pipeline::from<Event>(options)
+   *     .map(f).filter(p).window(n, reduce).aggregate(init, fold).sink(consume, end);
+   *   source.push(event); ... source.close();
+   *
+   * - Items move between stages in batches of options.batch items, a batch is one behaviour
+   *   per stage rather than one per item.
+   * - window and aggregate are stateful, each owns its state in a cown, so they see their
+   *   batches one at a time and in order.  sink is a cown as well.
+   * - map and filter are stateless.  With options.fuse a run of stateless stages is fused
+   *   into the stage before it: it runs in the same behaviour (or on the thread pushing into
+   *   the source) and the batch goes on to the next stateful stage without another
+   *   behaviour.  Without it each stateless stage is a cown of its own, like a stateful one.
+   * - Every stage processes its batches in the order the source pushed them, so the output
+   *   does not depend on fusion, only the batching decides how often aggregate emits.
+   * - close pushes the last partial batch and an end marker, which flushes a partial window
+   *   and calls the sink's end once every item before it has been consumed.
+   * - A Source buffers the batch being filled, so it must be pushed to by one thread or
+   *   behaviour at a time.
+   */
+
+  struct Options
+  {
+    size_t batch = 1024;
+    bool fuse = true;
+  };
+
+  template<typename T>
+  struct Batch
+  {
+    std::vector<T> items;
+    bool end = false;
+  };
+
+  template<typename T>
+  using Emit = std::function<void(Batch<T>&&)>;
+
+  namespace detail
+  {
+    struct Stage {};
+
+    // runs f on each batch in a behaviour on a cown of its own
+    template<typename T, typename F>
+    Emit<T> on_cown(F f) {
+      auto stage = verona::cpp::make_cown<Stage>();
+      auto fn = std::make_shared<F>(std::move(f));
+      return [stage, fn](Batch<T>&& batch) {
+        verona::cpp::when(stage) << [fn, batch = std::move(batch)](verona::cpp::acquired_cown<Stage>) mutable {
+          (*fn)(std::move(batch));
+        };
+      };
+    }
+
+    template<typename S, typename T, typename F>
+    Emit<T> on_state(S initial, F f) {
+      auto state = verona::cpp::make_cown<S>(std::move(initial));
+      auto fn = std::make_shared<F>(std::move(f));
+      return [state, fn](Batch<T>&& batch) {
+        verona::cpp::when(state) << [fn, batch = std::move(batch)](verona::cpp::acquired_cown<S> s) mutable {
+          (*fn)(*s, std::move(batch));
+        };
+      };
+    }
+  }
+
+  template<typename In>
+  class Source
+  {
+    Emit<In> head;
+    size_t batch;
+    std::vector<In> buffer;
+
+  public:
+    Source(Emit<In> head, size_t batch): head(std::move(head)), batch(std::max<size_t>(batch, 1)) {
+      buffer.reserve(this->batch);
+    }
+
+    void push(In item) {
+      buffer.push_back(std::move(item));
+      if (buffer.size() >= batch)
+        flush();
+    }
+
+    void flush() {
+      if (buffer.empty())
+        return;
+      head(Batch<In>{std::move(buffer), false});
+      buffer = std::vector<In>();
+      buffer.reserve(batch);
+    }
+
+    void close() { head(Batch<In>{std::move(buffer), true}); }
+  };
+
+  /*
+   * The stages from the source of In items to the current stage producing T items.  Stages
+   * are wired from the sink back, wire builds the emit of the source given that of the
+   * current stage.
+   */
+  template<typename In, typename T>
+  class Builder
+  {
+    template<typename, typename>
+    friend class Builder;
+
+    using Wire = std::function<Emit<In>(Emit<T>)>;
+
+    Options options;
+    Wire wire;
+
+    template<typename U>
+    Builder<In, U> then(std::function<Emit<T>(Emit<U>)> stage) const {
+      Wire w = wire;
+      return Builder<In, U>(options, [w, stage](Emit<U> next) { return w(stage(std::move(next))); });
+    }
+
+    // a stateless stage, g maps the items of a batch to the items it passes on
+    template<typename U, typename G>
+    Builder<In, U> stateless(G g) const {
+      bool fuse = options.fuse;
+      return then<U>([fuse, g](Emit<U> next) -> Emit<T> {
+        auto f = [g, next](Batch<T>&& batch) {
+          Batch<U> out{g(std::move(batch.items)), batch.end};
+          if (!out.items.empty() || out.end)
+            next(std::move(out));
+        };
+        if (fuse)
+          return f;
+        return detail::on_cown<T>(std::move(f));
+      });
+    }
+
+  public:
+    Builder(Options options, Wire wire): options(options), wire(std::move(wire)) {}
+
+    // f(T) -> U
+    template<typename F, typename U = std::invoke_result_t<F, T>>
+    Builder<In, U> map(F f) const {
+      return stateless<U>([f](std::vector<T>&& items) {
+        std::vector<U> out;
+        out.reserve(items.size());
+        for (auto& item : items)
+          out.push_back(f(std::move(item)));
+        return out;
+      });
+    }
+
+    // keeps the items for which p(const T&) holds
+    template<typename P>
+    Builder<In, T> filter(P p) const {
+      return stateless<T>([p](std::vector<T>&& items) {
+        std::vector<T> out;
+        out.reserve(items.size());
+        for (auto& item : items)
+          if (p(item))
+            out.push_back(std::move(item));
+        return out;
+      });
+    }
+
+    /*
+     * Tumbling windows of size items, reduce(std::vector<T>&&) -> U is called on each full
+     * window and on the last partial one.
+     */
+    template<typename R, typename U = std::invoke_result_t<R, std::vector<T>&&>>
+    Builder<In, U> window(size_t size, R reduce) const {
+      size = std::max<size_t>(size, 1);
+      return then<U>([size, reduce](Emit<U> next) -> Emit<T> {
+        return detail::on_state<std::vector<T>, T>(std::vector<T>(), [size, reduce, next](std::vector<T>& open, Batch<T>&& batch) {
+          Batch<U> out{{}, batch.end};
+          for (auto& item : batch.items) {
+            open.push_back(std::move(item));
+            if (open.size() == size) {
+              out.items.push_back(reduce(std::move(open)));
+              open.clear();
+            }
+          }
+          if (batch.end && !open.empty())
+            out.items.push_back(reduce(std::move(open)));
+          if (!out.items.empty() || out.end)
+            next(std::move(out));
+        });
+      });
+    }
+
+    /*
+     * A running aggregate, fold(S&, const T&) is applied to each item and the aggregate is
+     * emitted after each batch.
+     */
+    template<typename S, typename F>
+    Builder<In, S> aggregate(S initial, F fold) const {
+      return then<S>([initial, fold](Emit<S> next) -> Emit<T> {
+        return detail::on_state<S, T>(initial, [fold, next](S& s, Batch<T>&& batch) {
+          for (auto& item : batch.items)
+            fold(s, item);
+          next(Batch<S>{{s}, batch.end});
+        });
+      });
+    }
+
+    /*
+     * consume(std::vector<T>&&) is called on each batch and end() after the last one, both in
+     * behaviours on the sink's cown.
+     */
+    template<typename C, typename E>
+    Source<In> sink(C consume, E end) const {
+      Emit<T> last = detail::on_cown<T>([consume, end](Batch<T>&& batch) mutable {
+        if (!batch.items.empty())
+          consume(std::move(batch.items));
+        if (batch.end)
+          end();
+      });
+      return Source<In>(wire(std::move(last)), options.batch);
+    }
+  };
+
+  template<typename In>
+  Builder<In, In> from(Options options = {}) {
+    return Builder<In, In>(options, [](Emit<In> next) { return next; });
+  }
+}
@@ -0,0 +1,208 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include <cpp/when.h>
+#include <boc/admission.h>
+
+namespace boc
+{
+  enum class Priority
+  {
+    high,
+    normal,
+    background
+  };
+
+  /*
+   * Priority lanes in front of the runtime's run queues, which are FIFO: a behaviour spawned
+   * with a priority is held back in a lane until it can be spawned without queueing behind
+   * more than a bounded amount of work.
+   *
+   * - lanes.when(priority, cowns...) << f spawns when(cowns...) << f once it is admitted by
+   *   an Admission of bound, so at most bound behaviours spawned through the lanes are
+   *   outstanding.  A high priority behaviour then waits for one of those to complete rather
+   *   than for every background behaviour spawned before it.
+   * - Every behaviour completing dispatches the next: the oldest of the highest priority lane
+   *   holding any.  Each spawning thread has its own set of lanes (shards), a dispatch looks
+   *   at the lanes of its own thread first and then at the others.
+   * - Starvation: a lane passed over patience times while holding behaviours is dispatched
+   *   from next, even if a higher lane holds behaviours too.
+   * - Behaviours are dispatched in order within the lane of one thread only.  Two behaviours
+   *   on a cown spawned with different priorities, or from different threads, may run in
+   *   either order, as if they had been spawned concurrently.
+   * - bound trades throughput for latency: it must be at least the number of cores to keep
+   *   every core busy.
+   */
+  class Lanes
+  {
+    static constexpr size_t count = 3;
+
+    using Closure = std::function<void()>;
+
+    struct Shard
+    {
+      std::mutex lock;
+      std::array<std::deque<Closure>, count> lanes;
+    };
+
+    Admission slots;
+    const size_t patience;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::array<std::atomic<size_t>, count> waiting{};
+    std::array<std::atomic<size_t>, count> passed{};
+    std::array<std::atomic<size_t>, count> dispatched{};
+    std::atomic<size_t> starved{0};
+
+    size_t home() const {
+      static std::atomic<size_t> next{0};
+      thread_local size_t mine = next++;
+      return mine % shards.size();
+    }
+
+    void push(Priority p, Closure f) {
+      size_t lane = size_t(p);
+      Shard& s = *shards[home()];
+      {
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.lanes[lane].push_back(std::move(f));
+        waiting[lane]++;
+      }
+    }
+
+    bool pop(size_t lane, Closure& f) {
+      size_t first = home();
+      for (size_t i = 0; i < shards.size(); ++i) {
+        Shard& s = *shards[(first + i) % shards.size()];
+        std::lock_guard<std::mutex> guard(s.lock);
+        if (!s.lanes[lane].empty()) {
+          f = std::move(s.lanes[lane].front());
+          s.lanes[lane].pop_front();
+          waiting[lane]--;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // the lane to dispatch from next, count if every lane is empty
+    size_t choose() {
+      size_t chosen = count;
+      for (size_t lane = 0; lane < count; ++lane) {
+        if (waiting[lane] == 0)
+          continue;
+        if (chosen == count) {
+          chosen = lane;
+        } else if (passed[lane] >= patience) {
+          chosen = lane;
+          starved++;
+          break;
+        }
+      }
+      if (chosen == count)
+        return chosen;
+      for (size_t lane = 0; lane < count; ++lane) {
+        if (lane == chosen)
+          passed[lane] = 0;
+        else if (waiting[lane] > 0 && lane > chosen)
+          passed[lane]++;
+      }
+      return chosen;
+    }
+
+    bool next(Closure& f) {
+      size_t chosen = choose();
+      if (chosen == count)
+        return false;
+      if (pop(chosen, f)) {
+        dispatched[chosen]++;
+        return true;
+      }
+      // taken by another dispatch since choose, take whatever is left
+      for (size_t lane = 0; lane < count; ++lane) {
+        if (pop(lane, f)) {
+          dispatched[lane]++;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void dispatch() {
+      while (waiting[0] + waiting[1] + waiting[2] > 0) {
+        if (!slots.try_admit())
+          return;
+        Closure f;
+        if (!next(f)) {
+          slots.release();
+          continue;
+        }
+        f();
+      }
+    }
+
+    void completed() {
+      slots.release();
+      dispatch();
+    }
+
+  public:
+    template<typename... T>
+    class Spawn
+    {
+      Lanes& lanes;
+      const Priority priority;
+      std::tuple<verona::cpp::cown_ptr<T>...> cowns;
+
+    public:
+      Spawn(Lanes& lanes, Priority priority, verona::cpp::cown_ptr<T>... cowns)
+      : lanes(lanes), priority(priority), cowns(std::move(cowns)...) {}
+
+      template<typename F>
+      void operator<<(F f) {
+        Lanes* l = &lanes;
+        lanes.push(priority, [l, cowns = std::move(cowns), f = std::move(f)]() mutable {
+          std::apply([&](auto&... c) {
+            verona::cpp::when(std::move(c)...) << [l, f = std::move(f)](auto&&... args) mutable {
+              f(std::forward<decltype(args)>(args)...);
+              l->completed();
+            };
+          }, cowns);
+        });
+        lanes.dispatch();
+      }
+    };
+
+    Lanes(size_t bound, size_t shards = 1, size_t patience = 64)
+    : slots(std::max<size_t>(bound, 1)), patience(std::max<size_t>(patience, 1)) {
+      for (size_t i = 0; i < std::max<size_t>(shards, 1); ++i)
+        this->shards.push_back(std::make_unique<Shard>());
+    }
+
+    Lanes(const Lanes&) = delete;
+
+    template<typename... T>
+    Spawn<T...> when(Priority priority, verona::cpp::cown_ptr<T>... cowns) {
+      return Spawn<T...>(*this, priority, std::move(cowns)...);
+    }
+
+    // behaviours spawned through the lanes and not yet completed
+    size_t outstanding() const { return slots.outstanding(); }
+
+    size_t queued(Priority p) const { return waiting[size_t(p)]; }
+
+    size_t dispatches(Priority p) const { return dispatched[size_t(p)]; }
+
+    // dispatches made from a lane because it had been passed over patience times
+    size_t starvations() const { return starved; }
+  };
+}
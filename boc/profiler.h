@@ -0,0 +1,215 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <debug/harness.h>
+#include <boc/trace.h>
+
+namespace boc::profile
+{
+  /*
+   * Opt-in per cown contention profiling.
+   *
+   * - A cown is profiled by creating a Tag for it with a user supplied name, the tag is kept
+   *   alongside the cown_ptr by whoever spawns behaviours on the cown.
+   * - Behaviours are profiled by wrapping their closure with track, passing the tags of the
+   *   cowns the behaviour requires.
+   * - For each tag we record:
+   *   - the number of behaviours that required the cown
+   *   - the cumulative queue wait, the time between spawning a behaviour and it starting
+   *   - the cumulative hold time, the time the behaviour spent running while holding the cown
+   *   - the maximum queue depth, the most behaviours spawned on the cown that had not completed
+   * - Profiling is enabled with --profile, when neither profiling nor tracing (boc/trace.h) is
+   *   enabled tag returns nullptr and track only adds a branch to each behaviour.
+   * - When tracing is enabled track also records the behaviour in the trace, behaviours that do
+   *   not require tagged cowns can be traced with a label instead.
+   * - Defining BOC_NO_INSTRUMENTATION (as the _bench targets do) compiles profiling and tracing
+   *   out, track returns the closure unchanged and the options are ignored.
+   * - report prints the --profile_top (default 10) cowns with the highest cumulative wait and
+   *   then forgets all tags, it is called in main after each harness.run.
+   */
+
+  using Clock = std::chrono::steady_clock;
+
+  inline uint64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  }
+
+  struct CownStats
+  {
+    const std::string name;
+    const uint32_t trace_id;
+    std::atomic<size_t> behaviours{0};
+    std::atomic<uint64_t> wait_ns{0};
+    std::atomic<uint64_t> hold_ns{0};
+    std::atomic<size_t> depth{0};
+    std::atomic<size_t> max_depth{0};
+
+    CownStats(std::string name, uint32_t trace_id): name(std::move(name)), trace_id(trace_id) {}
+
+    void spawned() {
+      behaviours++;
+      size_t d = ++depth;
+      size_t m = max_depth.load(std::memory_order_relaxed);
+      while (d > m && !max_depth.compare_exchange_weak(m, d, std::memory_order_relaxed)) {}
+    }
+
+    void completed(uint64_t wait, uint64_t hold) {
+      wait_ns.fetch_add(wait, std::memory_order_relaxed);
+      hold_ns.fetch_add(hold, std::memory_order_relaxed);
+      --depth;
+    }
+  };
+
+  using Tag = CownStats*;
+
+  class Profiler
+  {
+    std::mutex lock;
+    std::deque<CownStats> stats;
+    bool enabled = false;
+    size_t top = 10;
+
+  public:
+    static Profiler& get() {
+      static Profiler profiler;
+      return profiler;
+    }
+
+    bool profiling() const { return enabled; }
+
+    void configure(opt::Opt& opt) {
+#ifndef BOC_NO_INSTRUMENTATION
+      enabled = opt.has("--profile");
+      top = opt.is<size_t>("--profile_top", top);
+#else
+      UNUSED(opt);
+#endif
+    }
+
+    Tag tag(std::string name) {
+      auto& tracer = trace::Tracer::get();
+      if (!enabled && !tracer.enabled())
+        return nullptr;
+      uint32_t trace_id = tracer.enabled() ? tracer.cown(name) : 0;
+      std::lock_guard<std::mutex> guard(lock);
+      return &stats.emplace_back(std::move(name), trace_id);
+    }
+
+    void report(std::ostream& out) {
+      if (!enabled) {
+        stats.clear();
+        return;
+      }
+
+      std::vector<CownStats*> sorted;
+      for (auto& s : stats)
+        sorted.push_back(&s);
+      std::sort(sorted.begin(), sorted.end(), [](CownStats* a, CownStats* b) { return a->wait_ns > b->wait_ns; });
+
+      out << "Most contended cowns (" << std::min(top, sorted.size()) << " of " << sorted.size() << ")" << std::endl;
+      out << std::left << std::setw(24) << "cown" << std::right
+          << std::setw(12) << "behaviours" << std::setw(14) << "wait ms" << std::setw(14) << "mean wait us"
+          << std::setw(14) << "hold ms" << std::setw(10) << "max depth" << std::endl;
+      for (size_t i = 0; i < std::min(top, sorted.size()); ++i) {
+        CownStats& s = *sorted[i];
+        size_t n = std::max<size_t>(s.behaviours, 1);
+        out << std::left << std::setw(24) << s.name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << s.behaviours << std::setw(14) << s.wait_ns / 1e6 << std::setw(14) << s.wait_ns / 1e3 / n
+            << std::setw(14) << s.hold_ns / 1e6 << std::setw(10) << s.max_depth << std::endl;
+      }
+
+      stats.clear();
+    }
+  };
+
+  inline void configure(opt::Opt& opt) { Profiler::get().configure(opt); }
+
+  inline Tag tag(std::string name) { return Profiler::get().tag(std::move(name)); }
+
+  inline void report() { Profiler::get().report(std::cout); }
+
+  /*
+   * Wraps the closure of a behaviour that requires the cowns with the given tags, the result
+   * is used in place of the closure: when(a, b) << track({ta, tb}, [](...) {...});
+   * The tags must be evaluated before the closure captures anything they are read from.
+   */
+  template<size_t N, typename F>
+  auto track(const char* label, const Tag (&tags)[N], F&& f)
+  {
+#ifdef BOC_NO_INSTRUMENTATION
+    UNUSED(label);
+    UNUSED(tags);
+    return std::forward<F>(f);
+#else
+    bool profiling = Profiler::get().profiling();
+    auto& tracer = trace::Tracer::get();
+
+    std::array<Tag, N> ts;
+    std::array<uint32_t, N> ids;
+    size_t count = 0;
+    bool active = false;
+    for (size_t i = 0; i < N; ++i) {
+      ts[i] = tags[i];
+      if (ts[i]) {
+        if (profiling)
+          ts[i]->spawned();
+        ids[count++] = ts[i]->trace_id;
+        active = true;
+      }
+    }
+
+    uint64_t behaviour = 0;
+    if (tracer.enabled()) {
+      behaviour = tracer.spawn(label, ids.data(), count);
+      active = true;
+    }
+
+    uint64_t spawned = active ? now() : 0;
+    return [ts, spawned, behaviour, profiling, f = std::forward<F>(f)](auto&&... args) mutable {
+      if (!spawned) {
+        f(std::forward<decltype(args)>(args)...);
+        return;
+      }
+
+      auto& tracer = trace::Tracer::get();
+      uint64_t start = now();
+      if (behaviour)
+        tracer.record(behaviour, trace::Phase::Start, start);
+      f(std::forward<decltype(args)>(args)...);
+      uint64_t end = now();
+      if (behaviour)
+        tracer.record(behaviour, trace::Phase::End, end);
+
+      if (profiling)
+        for (auto t : ts)
+          if (t)
+            t->completed(start - spawned, end - start);
+    };
+#endif
+  }
+
+  template<size_t N, typename F>
+  auto track(const Tag (&tags)[N], F&& f)
+  {
+    return track(nullptr, tags, std::forward<F>(f));
+  }
+
+  template<typename F>
+  auto track(const char* label, F&& f)
+  {
+    const Tag none[] = {nullptr};
+    return track(label, none, std::forward<F>(f));
+  }
+}
@@ -0,0 +1,214 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <variant>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc
+{
+  /*
+   * A cancellation token shared by a promise and the behaviours computing its value.
+   *
+   * - cancel is idempotent and also cancels the tokens adopted by this one, so cancelling
+   *   the promise of a join or an any cancels the promises it was made from.
+   * - Cancellation is cooperative: a behaviour producing a value calls skip() before doing
+   *   any work and abort() between steps of long work, and returns if they are true.  Both
+   *   count the work saved in counters().
+   * - Fulfilling a cancelled promise is dropped without spawning a behaviour.
+   */
+  class Cancellation
+  {
+    struct State
+    {
+      std::atomic<bool> cancelled{false};
+      std::mutex lock;
+      std::vector<std::weak_ptr<State>> children;
+    };
+
+    std::shared_ptr<State> state;
+
+    static void cancel(const std::shared_ptr<State>& s) {
+      if (s->cancelled.exchange(true))
+        return;
+      std::vector<std::weak_ptr<State>> children;
+      {
+        std::lock_guard<std::mutex> guard(s->lock);
+        children.swap(s->children);
+      }
+      for (auto& child : children)
+        if (auto c = child.lock())
+          cancel(c);
+    }
+
+  public:
+    struct Counters
+    {
+      // behaviours that did not start their work
+      std::atomic<size_t> skipped{0};
+      // behaviours that stopped part way
+      std::atomic<size_t> aborted{0};
+      // fulfills of cancelled promises
+      std::atomic<size_t> dropped{0};
+    };
+
+    static Counters& counters() {
+      static Counters c;
+      return c;
+    }
+
+    Cancellation(): state(std::make_shared<State>()) {}
+
+    void cancel() const { cancel(state); }
+
+    bool cancelled() const { return state->cancelled.load(std::memory_order_relaxed); }
+
+    bool skip() const {
+      if (!cancelled())
+        return false;
+      counters().skipped++;
+      return true;
+    }
+
+    bool abort() const {
+      if (!cancelled())
+        return false;
+      counters().aborted++;
+      return true;
+    }
+
+    // child is cancelled when this is, at once if this already is
+    void adopt(const Cancellation& child) const {
+      {
+        std::lock_guard<std::mutex> guard(state->lock);
+        if (!state->cancelled) {
+          state->children.push_back(child.state);
+          return;
+        }
+      }
+      child.cancel();
+    }
+  };
+
+  /*
+   * A value that will be available later, fulfilled once by whichever behaviour computes it.
+   * then(f) calls f with the value in a behaviour once it is fulfilled, and join and any make
+   * a promise from several others.  Each promise has a Cancellation, see token().
+   */
+  template<typename T>
+  class promise
+  {
+    struct internal
+    {
+      std::optional<const T> v;
+      std::deque<std::function<void(const T&)>> q;
+    };
+
+    verona::cpp::cown_ptr<internal> inner;
+    Cancellation cancellation;
+
+  public:
+    promise(): inner(verona::cpp::make_cown<internal>()) {}
+
+    explicit promise(Cancellation cancellation)
+    : inner(verona::cpp::make_cown<internal>()), cancellation(std::move(cancellation)) {}
+
+    promise<T>& then(std::function<void(const T&)> f) {
+      verona::cpp::when(inner) << [f = std::move(f)](verona::cpp::acquired_cown<internal> inner) mutable {
+        if (inner->v) {
+          f(inner->v.value());
+        } else {
+          inner->q.emplace_back(std::move(f));
+        }
+      };
+      return *this;
+    }
+
+    void fulfill(const T v) {
+      if (cancellation.cancelled()) {
+        Cancellation::counters().dropped++;
+        return;
+      }
+      verona::cpp::when(inner) << [v = std::move(v)](verona::cpp::acquired_cown<internal> inner) mutable {
+        if (!inner->v) {
+          inner->v.emplace(std::move(v));
+          while (!inner->q.empty()) {
+            inner->q.front()(inner->v.value());
+            inner->q.pop_front();
+          }
+        }
+      };
+    }
+
+    // the token the behaviours computing this promise check, cancelled by cancel
+    const Cancellation& token() const { return cancellation; }
+
+    void cancel() const { cancellation.cancel(); }
+  };
+
+  namespace detail
+  {
+    template<typename... Args>
+    void join(promise<std::tuple<Args...>> p, std::tuple<Args...> r) {
+      p.fulfill(r);
+    }
+
+    template<typename... Args1, typename... Args2, typename Arg, typename... Args3>
+    void join(promise<std::tuple<Args1...>> p, std::tuple<Args2...> r, promise<Arg> pr, promise<Args3>... prs) {
+      // Args1 = Args2 ++ [Arg] ++ Args3
+      pr.then([p, r, prs...](const auto& v) mutable {
+        join(p, std::tuple_cat(r, std::make_tuple(v)), prs...);
+      });
+    }
+  }
+
+  template<typename... Args>
+  promise<std::tuple<Args...>> join(promise<Args>... ps) {
+    promise<std::tuple<Args...>> p;
+    (p.token().adopt(ps.token()), ...);
+    detail::join(p, std::make_tuple(), ps...);
+    return p;
+  }
+
+  /*
+   * Fulfilled by the first of ps to be fulfilled, the others are then cancelled.
+   */
+  template<typename... Args>
+  promise<std::variant<Args...>> any(promise<Args>... ps) {
+    promise<std::variant<Args...>> p;
+    (p.token().adopt(ps.token()), ...);
+    auto losers = std::make_shared<std::vector<Cancellation>>(std::vector<Cancellation>{ps.token()...});
+    (ps.then([p, losers](const auto& v) mutable {
+      p.fulfill(v);
+      for (auto& c : *losers)
+        c.cancel();
+    }), ...);
+    return p;
+  }
+
+  template<typename T>
+  promise<T> any(const std::vector<promise<T>>& ps) {
+    promise<T> p;
+    auto losers = std::make_shared<std::vector<Cancellation>>();
+    for (auto& q : ps) {
+      p.token().adopt(q.token());
+      losers->push_back(q.token());
+    }
+    for (auto q : ps) {
+      q.then([p, losers](const T& v) mutable {
+        p.fulfill(v);
+        for (auto& c : *losers)
+          c.cancel();
+      });
+    }
+    return p;
+  }
+}
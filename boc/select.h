@@ -0,0 +1,117 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cpp/when.h>
+#include <boc/workload.h>
+
+namespace boc
+{
+  /*
+   * A channel of values that a reader can wait on together with other channels.
+   *
+   * - A channel is a cown holding the values written and not yet read, and the readers
+   *   waiting for a value, as in Channels::Channel.
+   * - select(channels, k) waits for the first value on any of the channels: one behaviour
+   *   acquires every channel, takes a value from the first that has one or registers the same
+   *   waiter on all of them.  k(index, value) is called once, with the index of the channel.
+   * - The scan for a value starts at a random channel, so each of n channels holding values is
+   *   taken with probability at least 1/n and no channel starves behind lower indexes.
+   * - A write hands its value to the first waiter of the channel that claims it, a waiter is
+   *   claimed once by an atomic exchange.  The waiter's registrations on the other channels are
+   *   then dead, cancelled in O(1) by that exchange, and each is dropped in O(1) when its
+   *   channel reaches it, by a write or by a later registration.
+   * - k runs in the behaviour of the write (or of the select) holding that channel, so it
+   *   should be short, typically spawning the next step.
+   */
+  template<typename T>
+  class Channel
+  {
+  public:
+    using Continuation = std::function<void(size_t, T)>;
+
+  private:
+    struct Waiter
+    {
+      std::atomic<bool> fired{false};
+      Continuation k;
+
+      Waiter(Continuation k): k(std::move(k)) {}
+
+      bool claim() { return !fired.load(std::memory_order_relaxed) && !fired.exchange(true); }
+    };
+
+    struct Registration
+    {
+      std::shared_ptr<Waiter> waiter;
+      size_t index;
+    };
+
+    std::deque<T> values;
+    std::deque<Registration> waiters;
+    size_t cancelled = 0;
+
+    static Rng& rng() {
+      static std::atomic<uint64_t> seeds{0};
+      thread_local Rng r(++seeds);
+      return r;
+    }
+
+    void drop_dead() {
+      while (!waiters.empty() && waiters.front().waiter->fired.load(std::memory_order_relaxed)) {
+        waiters.pop_front();
+        cancelled++;
+      }
+    }
+
+  public:
+    static void write(verona::cpp::cown_ptr<Channel> channel, T value) {
+      verona::cpp::when(channel) << [value = std::move(value)](verona::cpp::acquired_cown<Channel> c) mutable {
+        while (!c->waiters.empty()) {
+          Registration r = std::move(c->waiters.front());
+          c->waiters.pop_front();
+          if (r.waiter->claim())
+            return r.waiter->k(r.index, std::move(value));
+          c->cancelled++;
+        }
+        c->values.push_back(std::move(value));
+      };
+    }
+
+    static void select(std::vector<verona::cpp::cown_ptr<Channel>>& channels, Continuation k) {
+      using namespace verona::cpp;
+      when(cown_array<Channel>(channels.data(), channels.size())) << [k = std::move(k)](acquired_cown_span<Channel> all) mutable {
+        size_t offset = all.length > 1 ? size_t(rng().below(all.length)) : 0;
+        for (size_t n = 0; n < all.length; ++n) {
+          size_t i = (offset + n) % all.length;
+          auto& c = all[i];
+          if (!c->values.empty()) {
+            T value = std::move(c->values.front());
+            c->values.pop_front();
+            return k(i, std::move(value));
+          }
+        }
+        auto waiter = std::make_shared<Waiter>(std::move(k));
+        for (size_t i = 0; i < all.length; ++i) {
+          all[i]->drop_dead();
+          all[i]->waiters.push_back(Registration{waiter, i});
+        }
+      };
+    }
+
+    static void read(verona::cpp::cown_ptr<Channel> channel, std::function<void(T)> k) {
+      std::vector<verona::cpp::cown_ptr<Channel>> one{std::move(channel)};
+      select(one, [k = std::move(k)](size_t, T value) { k(std::move(value)); });
+    }
+
+    size_t size() const { return values.size(); }
+
+    // registrations dropped because their waiter was claimed by another channel
+    size_t dead() const { return cancelled; }
+  };
+}
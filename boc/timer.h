@@ -0,0 +1,278 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <cpp/when.h>
+#include <boc/promise.h>
+
+namespace boc
+{
+  /*
+   * Behaviours scheduled for later, on a hierarchical timing wheel (Varghese and Lauck,
+   * Hashed and Hierarchical Timing Wheels).
+   *
+   * - Time is counted in ticks of resolution from the construction of the Timers.  The wheel
+   *   has four levels of 256 slots, level l holding the timers due between 256^l and
+   *   256^(l+1) ticks from now; when level 0 wraps, the next slot of level 1 is cascaded
+   *   into level 0, and so on up.  A timer 2^32 or more ticks away is held in the top level
+   *   as if it were due in 2^32 - 1 ticks and linked again each time its slot is cascaded,
+   *   until it is within range.
+   * - A timer is a node in a pool with an intrusive list per slot, so after and cancel are
+   *   O(1).  A Handle holds the node and its generation, cancelling a timer that has fired
+   *   or was cancelled already returns false.
+   * - A timer fires by calling its function, when_after's spawns a behaviour on the given
+   *   cowns.  A thread provided by the caller calls serve, which advances the wheel every
+   *   tick and fires the timers that are due outside the lock.
+   * - The Timers registers an external event source with the runtime until close, timers
+   *   still pending at close never fire.
+   */
+  class Timers
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Handle
+    {
+      uint32_t index = none;
+      uint32_t generation = 0;
+    };
+
+  private:
+    static constexpr uint32_t none = ~uint32_t(0);
+    static constexpr size_t levels = 4;
+    static constexpr size_t slots = 256;
+
+    struct Node
+    {
+      uint64_t due = 0;
+      uint32_t prev = none;
+      uint32_t next = none;
+      uint32_t bucket = none;
+      uint32_t generation = 0;
+      std::function<void()> fire;
+    };
+
+    const Clock::duration resolution;
+    const Clock::time_point start;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    bool closing = false;
+    uint64_t current = 0;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> free_nodes;
+    std::array<uint32_t, levels * slots> buckets;
+    size_t pending = 0;
+    uint64_t fired = 0;
+    uint64_t cancelled = 0;
+
+    void link(uint32_t i) {
+      Node& n = nodes[i];
+      // out of range timers are placed at the furthest tick in range, their due is kept
+      uint64_t at = std::min(n.due, current + (uint64_t(1) << 32) - 1);
+      uint64_t diff = at - current;
+      size_t level = 0;
+      while (diff >= (uint64_t(1) << (8 * (level + 1))))
+        level++;
+      uint32_t b = uint32_t(level * slots + ((at >> (8 * level)) & (slots - 1)));
+
+      n.bucket = b;
+      n.prev = none;
+      n.next = buckets[b];
+      if (n.next != none)
+        nodes[n.next].prev = i;
+      buckets[b] = i;
+    }
+
+    void unlink(uint32_t i) {
+      Node& n = nodes[i];
+      if (n.prev != none)
+        nodes[n.prev].next = n.next;
+      else
+        buckets[n.bucket] = n.next;
+      if (n.next != none)
+        nodes[n.next].prev = n.prev;
+      n.bucket = none;
+    }
+
+    void release(uint32_t i) {
+      nodes[i].generation++;
+      nodes[i].fire = nullptr;
+      free_nodes.push_back(i);
+      pending--;
+    }
+
+    uint32_t take_bucket(uint32_t b) {
+      uint32_t head = buckets[b];
+      buckets[b] = none;
+      return head;
+    }
+
+    // moves the timers due at tick current into due and advances current, holding lock
+    void tick(std::vector<std::function<void()>>& due) {
+      size_t index = current & (slots - 1);
+      if (index == 0) {
+        for (size_t level = 1; level < levels; ++level) {
+          size_t slot = (current >> (8 * level)) & (slots - 1);
+          for (uint32_t i = take_bucket(uint32_t(level * slots + slot)); i != none;) {
+            uint32_t next = nodes[i].next;
+            link(i);
+            i = next;
+          }
+          if (slot != 0)
+            break;
+        }
+      }
+      for (uint32_t i = take_bucket(uint32_t(index)); i != none;) {
+        uint32_t next = nodes[i].next;
+        nodes[i].bucket = none;
+        due.push_back(std::move(nodes[i].fire));
+        release(i);
+        fired++;
+        i = next;
+      }
+      current++;
+    }
+
+    // the first tick at or after t
+    uint64_t due_tick(Clock::time_point t) const {
+      if (t <= start)
+        return 0;
+      return uint64_t((t - start + resolution - Clock::duration(1)) / resolution);
+    }
+
+    // the last tick at or before t
+    uint64_t elapsed(Clock::time_point t) const { return t <= start ? 0 : uint64_t((t - start) / resolution); }
+
+  public:
+    explicit Timers(Clock::duration resolution = std::chrono::milliseconds(1))
+    : resolution(resolution), start(Clock::now()) {
+      buckets.fill(none);
+      verona::rt::Scheduler::add_external_event_source();
+    }
+
+    Timers(const Timers&) = delete;
+
+    /*
+     * Calls fire from the serving thread once delay has passed, at the first tick at or after it.
+     */
+    Handle after(Clock::duration delay, std::function<void()> fire) {
+      uint64_t due = due_tick(Clock::now() + delay);
+      std::lock_guard<std::mutex> guard(lock);
+      uint32_t i;
+      if (free_nodes.empty()) {
+        i = uint32_t(nodes.size());
+        nodes.emplace_back();
+      } else {
+        i = free_nodes.back();
+        free_nodes.pop_back();
+      }
+      nodes[i].due = std::max(due, current);
+      nodes[i].fire = std::move(fire);
+      link(i);
+      pending++;
+      return Handle{i, nodes[i].generation};
+    }
+
+    // spawns when(cowns...) << f once delay has passed
+    template<typename F, typename... T>
+    Handle when_after(Clock::duration delay, F f, verona::cpp::cown_ptr<T>... cowns) {
+      return after(delay, [f = std::move(f), cowns...]() mutable { verona::cpp::when(cowns...) << std::move(f); });
+    }
+
+    bool cancel(Handle h) {
+      std::function<void()> fire;
+      std::lock_guard<std::mutex> guard(lock);
+      if (h.index >= nodes.size() || nodes[h.index].generation != h.generation || nodes[h.index].bucket == none)
+        return false;
+      unlink(h.index);
+      // destroyed after the lock is released
+      fire = std::move(nodes[h.index].fire);
+      release(h.index);
+      cancelled++;
+      return true;
+    }
+
+    /*
+     * Advances the wheel until close, firing the timers.
+     */
+    void serve() {
+      std::vector<std::function<void()>> due;
+      std::unique_lock<std::mutex> guard(lock);
+      while (!closing) {
+        uint64_t now = elapsed(Clock::now());
+        while (current <= now)
+          tick(due);
+        if (!due.empty()) {
+          guard.unlock();
+          for (auto& f : due)
+            f();
+          due.clear();
+          guard.lock();
+          continue;
+        }
+        wake.wait_until(guard, start + resolution * current);
+      }
+
+      // drop what never fired, outside the lock
+      std::vector<Node> dropped;
+      dropped.swap(nodes);
+      free_nodes.clear();
+      buckets.fill(none);
+      pending = 0;
+      guard.unlock();
+      dropped.clear();
+      verona::rt::Scheduler::remove_external_event_source();
+    }
+
+    void close() {
+      std::lock_guard<std::mutex> guard(lock);
+      closing = true;
+      wake.notify_all();
+    }
+
+    size_t size() {
+      std::lock_guard<std::mutex> guard(lock);
+      return pending;
+    }
+
+    uint64_t fires() {
+      std::lock_guard<std::mutex> guard(lock);
+      return fired;
+    }
+
+    uint64_t cancels() {
+      std::lock_guard<std::mutex> guard(lock);
+      return cancelled;
+    }
+  };
+
+  /*
+   * A promise fulfilled with p's value, or with nullopt if p is not fulfilled within delay, in
+   * which case p is cancelled.  The timer is cancelled if p is fulfilled first, so timers is
+   * used when p is fulfilled: it must not be destroyed while p may still be fulfilled.
+   */
+  template<typename T>
+  promise<std::optional<T>> with_timeout(Timers& timers, promise<T> p, Timers::Clock::duration delay) {
+    promise<std::optional<T>> r;
+    r.token().adopt(p.token());
+    auto handle = timers.after(delay, [r, p]() mutable {
+      r.fulfill(std::nullopt);
+      p.cancel();
+    });
+    p.then([r, &timers, handle](const T& v) mutable {
+      timers.cancel(handle);
+      r.fulfill(v);
+    });
+    return r;
+  }
+}
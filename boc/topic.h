@@ -0,0 +1,251 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc
+{
+  /*
+   * A one to many broadcast of immutable messages.
+   *
+   * - A message is a std::shared_ptr<const T>, published once into a log shared by every
+   *   subscriber, subscribers are handed pointers into the log and never a copy.
+   * - The log is a list of segments of segment_size messages.  A subscriber holds its
+   *   segment and its cursor, segments are freed once every subscriber has moved past them.
+   * - A subscriber is a cown of the subscriber's choosing and f(acquired_cown<S>&, const
+   *   Message*, size_t) is called in a behaviour on it with the messages published since the
+   *   last delivery, in order.  A subscriber has at most one delivery pending, so a publish
+   *   spawns behaviours only on subscribers that have caught up, the others take every
+   *   message published meanwhile in their next batch.
+   * - No subscriber lags more than max_lag messages behind the publisher.  With Policy::drop
+   *   a subscriber that falls further behind skips to the last max_lag messages and the
+   *   skipped messages are counted in dropped().  With Policy::block publish holds a batch
+   *   back until the slowest subscriber has room for it, and calls then once it is published.
+   * - publish and close must be called by one publisher at a time.  close(done) calls done
+   *   from a behaviour once every subscriber has been delivered every message.
+   */
+  template<typename T>
+  class Topic
+  {
+  public:
+    using Message = std::shared_ptr<const T>;
+    enum class Policy { drop, block };
+
+    static constexpr size_t segment_size = 1024;
+
+  private:
+    struct Segment
+    {
+      uint64_t base;
+      Message slots[segment_size];
+      std::shared_ptr<Segment> next;
+
+      Segment(uint64_t base): base(base) {}
+    };
+
+    struct State;
+
+    struct Subscriber
+    {
+      std::function<void(std::shared_ptr<State>, Subscriber*)> spawn;
+      std::atomic<bool> scheduled{false};
+      std::atomic<uint64_t> consumed{0};
+      // only touched by the subscriber's deliveries
+      std::shared_ptr<Segment> segment;
+      uint64_t cursor = 0;
+      bool finished = false;
+    };
+
+    struct State
+    {
+      const size_t max_lag;
+      const Policy policy;
+      std::vector<std::unique_ptr<Subscriber>> subscribers;
+      std::shared_ptr<Segment> tail;
+      std::atomic<uint64_t> head{0};
+      std::atomic<uint64_t> dropped{0};
+      std::atomic<uint64_t> deliveries{0};
+      uint64_t low = 0;
+
+      std::atomic<bool> closed{false};
+      std::atomic<size_t> remaining{0};
+      std::function<void()> done;
+
+      std::mutex lock;
+      std::atomic<bool> blocked{false};
+      std::vector<Message> waiting;
+      std::function<void()> then;
+
+      State(size_t max_lag, Policy policy)
+      : max_lag(std::max<size_t>(max_lag, 1)), policy(policy), tail(std::make_shared<Segment>(0)) {}
+
+      /*
+       * Called after storing head or closed, delivered stores scheduled and then loads them:
+       * every access is seq_cst so at least one side sees the other's store and no message is
+       * left undelivered.  The load only avoids the exchange when a delivery is scheduled.
+       */
+      void wake(const std::shared_ptr<State>& self, Subscriber* s) {
+        if (!s->scheduled.load() && !s->scheduled.exchange(true))
+          s->spawn(self, s);
+      }
+
+      void append(const std::vector<Message>& messages) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        for (auto& m : messages) {
+          if (h - tail->base == segment_size) {
+            tail->next = std::make_shared<Segment>(h);
+            tail = tail->next;
+          }
+          tail->slots[h - tail->base] = m;
+          h++;
+        }
+        head.store(h);
+      }
+
+      // a batch of n fits if the slowest subscriber would lag at most max_lag
+      bool fits(size_t n) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h + n - low <= max_lag)
+          return true;
+        low = h;
+        for (auto& s : subscribers)
+          low = std::min(low, s->consumed.load(std::memory_order_acquire));
+        return h + n - low <= max_lag || h == low;
+      }
+
+      // called by subscribers that have consumed messages while a batch waits
+      void retry(const std::shared_ptr<State>& self) {
+        std::function<void()> k;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          if (!blocked || !fits(waiting.size()))
+            return;
+          append(waiting);
+          waiting.clear();
+          k = std::move(then);
+          blocked = false;
+        }
+        for (auto& s : subscribers)
+          wake(self, s.get());
+        if (k)
+          k();
+      }
+
+      void deliver_all(Subscriber* s, const std::function<void(const Message*, size_t)>& f) {
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (policy == Policy::drop && h - s->cursor > max_lag) {
+          uint64_t to = h - max_lag;
+          dropped += to - s->cursor;
+          while (to - s->segment->base >= segment_size)
+            s->segment = s->segment->next;
+          s->cursor = to;
+        }
+        while (s->cursor < h) {
+          if (s->cursor - s->segment->base == segment_size)
+            s->segment = s->segment->next;
+          size_t offset = size_t(s->cursor - s->segment->base);
+          size_t n = size_t(std::min<uint64_t>(h - s->cursor, segment_size - offset));
+          f(&s->segment->slots[offset], n);
+          s->cursor += n;
+          deliveries += n;
+        }
+        s->consumed.store(s->cursor);
+      }
+
+      void delivered(const std::shared_ptr<State>& self, Subscriber* s) {
+        if (closed && !s->finished && s->cursor == head.load()) {
+          s->finished = true;
+          if (--remaining == 0 && done)
+            done();
+        }
+        if (blocked)
+          retry(self);
+
+        s->scheduled.store(false);
+        if ((head.load() > s->cursor || (closed && !s->finished)) && !s->scheduled.exchange(true))
+          s->spawn(self, s);
+      }
+    };
+
+    std::shared_ptr<State> state;
+
+  public:
+    Topic(size_t max_lag, Policy policy = Policy::drop): state(std::make_shared<State>(max_lag, policy)) {}
+
+    Topic(const Topic&) = delete;
+
+    /*
+     * Subscribers must be added before the first publish.
+     */
+    template<typename S, typename F>
+    void subscribe(verona::cpp::cown_ptr<S> subscriber, F f) {
+      auto s = std::make_unique<Subscriber>();
+      s->segment = state->tail;
+      s->spawn = [subscriber, f = std::move(f)](std::shared_ptr<State> state, Subscriber* s) {
+        verona::cpp::when(subscriber) << [f, state = std::move(state), s](verona::cpp::acquired_cown<S> sub) mutable {
+          state->deliver_all(s, [&f, &sub](const Message* messages, size_t n) { f(sub, messages, n); });
+          state->delivered(state, s);
+        };
+      };
+      state->subscribers.push_back(std::move(s));
+    }
+
+    void publish(Message message) { publish(std::vector<Message>{std::move(message)}); }
+
+    /*
+     * then, if given, is called once the batch is published, under Policy::block possibly
+     * from a subscriber's behaviour, so it should only spawn work.  Under Policy::block a
+     * batch is published whole, so it should be no larger than max_lag.
+     */
+    void publish(std::vector<Message> messages, std::function<void()> then = {}) {
+      if (state->policy == Policy::block) {
+        std::unique_lock<std::mutex> guard(state->lock);
+        if (!state->fits(messages.size())) {
+          state->waiting = std::move(messages);
+          state->then = std::move(then);
+          state->blocked = true;
+          guard.unlock();
+          // a subscriber may have caught up before it could see the batch waiting
+          state->retry(state);
+          return;
+        }
+        state->append(messages);
+      } else {
+        state->append(messages);
+      }
+      for (auto& s : state->subscribers)
+        state->wake(state, s.get());
+      if (then)
+        then();
+    }
+
+    void close(std::function<void()> done) {
+      state->done = std::move(done);
+      state->remaining = state->subscribers.size();
+      state->closed = true;
+      if (state->subscribers.empty())
+        return verona::rt::schedule_lambda([done = std::move(state->done)]() { done(); });
+      for (auto& s : state->subscribers)
+        state->wake(state, s.get());
+    }
+
+    size_t subscribers() const { return state->subscribers.size(); }
+
+    // messages published
+    uint64_t published() const { return state->head; }
+
+    // messages skipped by lagging subscribers under Policy::drop
+    uint64_t dropped() const { return state->dropped; }
+
+    // messages handed to subscribers
+    uint64_t deliveries() const { return state->deliveries; }
+  };
+}
@@ -0,0 +1,238 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <debug/harness.h>
+
+namespace boc::trace
+{
+  /*
+   * Opt-in tracing of behaviour execution, exported as Chrome trace JSON for Perfetto or
+   * chrome://tracing.
+   *
+   * - Enabled with --trace <file>, the trace is written by dump after harness.run returns.
+   *   The first run is written to <file>, subsequent runs to <file>.1, <file>.2, ...
+   * - Each thread appends fixed size events to its own ring buffer, so recording takes no
+   *   locks, when a buffer is full the oldest events are overwritten.
+   *   --trace_buffer sets the number of events kept per thread.
+   * - For each behaviour we record:
+   *   - spawn: when and on which thread the closure was wrapped, with the cowns it requires
+   *   - start and end: when the user code began and finished, on the thread that ran it
+   *   The runtime does not expose when a behaviour is dispatched to a worker, the closure is
+   *   entered just before start so there is no separate dispatch time.
+   * - Cowns are named through cown ids, at most max_cowns are recorded per behaviour.
+   * - Behaviours are recorded through boc::profile::track, which is the only caller of the
+   *   recording functions below.
+   * - Defining BOC_NO_INSTRUMENTATION compiles tracing out and --trace is ignored.
+   */
+
+  constexpr size_t max_cowns = 4;
+
+  enum class Phase : uint8_t { Spawn, Start, End };
+
+  struct Event
+  {
+    uint64_t ts;
+    uint64_t behaviour;
+    const char* label;
+    uint32_t cowns[max_cowns];
+    uint8_t count;
+    Phase phase;
+  };
+
+  inline uint64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // s as the contents of a JSON string
+  inline std::string escape(const std::string& s)
+  {
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char hex[8];
+        std::snprintf(hex, sizeof(hex), "\\u%04x", unsigned(static_cast<unsigned char>(c)));
+        out += hex;
+      } else {
+        out += c;
+      }
+    }
+    return out;
+  }
+
+  class Tracer
+  {
+    struct Buffer
+    {
+      const uint32_t thread;
+      std::unique_ptr<Event[]> events;
+      const size_t capacity;
+      size_t next = 0;
+      uint64_t behaviours = 0;
+
+      Buffer(uint32_t thread, size_t capacity)
+      : thread(thread), events(std::make_unique<Event[]>(capacity)), capacity(capacity) {}
+
+      Event& append() { return events[next++ % capacity]; }
+    };
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::vector<std::string> cown_names;
+    std::string file;
+    size_t runs = 0;
+    size_t capacity = 1 << 16;
+    std::atomic<uint64_t> generation{0};
+    bool enabled_ = false;
+
+    Buffer& local() {
+      thread_local Buffer* buffer = nullptr;
+      thread_local uint64_t buffer_generation = 0;
+      if (!buffer || buffer_generation != generation.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(lock);
+        buffers.push_back(std::make_unique<Buffer>(uint32_t(buffers.size()), capacity));
+        buffer = buffers.back().get();
+        buffer_generation = generation.load(std::memory_order_relaxed);
+      }
+      return *buffer;
+    }
+
+  public:
+    static Tracer& get() {
+      static Tracer tracer;
+      return tracer;
+    }
+
+    bool enabled() const { return enabled_; }
+
+    void configure(opt::Opt& opt) {
+#ifndef BOC_NO_INSTRUMENTATION
+      const char* f = opt.is<const char*>("--trace", nullptr);
+      enabled_ = f != nullptr;
+      if (enabled_)
+        file = f;
+      capacity = std::max<size_t>(opt.is<size_t>("--trace_buffer", capacity), 1);
+#else
+      UNUSED(opt);
+#endif
+    }
+
+    uint32_t cown(std::string name) {
+      std::lock_guard<std::mutex> guard(lock);
+      cown_names.push_back(std::move(name));
+      return uint32_t(cown_names.size() - 1);
+    }
+
+    uint64_t spawn(const char* label, const uint32_t* cowns, size_t count) {
+      Buffer& b = local();
+      uint64_t id = (uint64_t(b.thread) << 40) | ++b.behaviours;
+      Event& e = b.append();
+      e.ts = now();
+      e.behaviour = id;
+      e.label = label;
+      e.count = uint8_t(count < max_cowns ? count : max_cowns);
+      for (size_t i = 0; i < e.count; ++i)
+        e.cowns[i] = cowns[i];
+      e.phase = Phase::Spawn;
+      return id;
+    }
+
+    void record(uint64_t behaviour, Phase phase, uint64_t ts) {
+      Event& e = local().append();
+      e.ts = ts;
+      e.behaviour = behaviour;
+      e.count = 0;
+      e.phase = phase;
+    }
+
+    /*
+     * Writes every buffered event to the --trace file and starts a new trace, this must only
+     * be called when no behaviours are running, i.e. after harness.run.
+     *
+     * Each behaviour becomes a complete event on the thread that ran it, with a flow arrow
+     * from the thread that spawned it.
+     */
+    void dump() {
+      if (!enabled_)
+        return;
+
+      struct Behaviour
+      {
+        const Event* spawn = nullptr;
+        uint32_t spawn_thread = 0;
+        uint32_t thread = 0;
+        uint64_t start = 0, end = 0;
+      };
+
+      std::lock_guard<std::mutex> guard(lock);
+      std::unordered_map<uint64_t, Behaviour> behaviours;
+      uint64_t origin = UINT64_MAX;
+      for (auto& b : buffers) {
+        size_t first = b->next > b->capacity ? b->next - b->capacity : 0;
+        for (size_t i = first; i < b->next; ++i) {
+          const Event& e = b->events[i % b->capacity];
+          Behaviour& beh = behaviours[e.behaviour];
+          origin = std::min(origin, e.ts);
+          switch (e.phase) {
+            case Phase::Spawn: beh.spawn = &e; beh.spawn_thread = b->thread; break;
+            case Phase::Start: beh.start = e.ts; beh.thread = b->thread; break;
+            case Phase::End: beh.end = e.ts; break;
+          }
+        }
+      }
+
+      auto us = [origin](uint64_t ts) { return double(ts - origin) / 1000; };
+      std::ofstream out(runs == 0 ? file : file + "." + std::to_string(runs));
+      runs++;
+      out << "[" << std::endl;
+      bool first = true;
+      for (auto& [id, beh] : behaviours) {
+        // behaviours whose events were overwritten or that never ran are dropped
+        if (!beh.spawn || !beh.start || !beh.end)
+          continue;
+
+        out << (first ? "" : ",\n");
+        first = false;
+
+        out << "{\"name\":\"" << escape(beh.spawn->label ? beh.spawn->label : "behaviour") << "\",\"ph\":\"X\",\"pid\":0"
+            << ",\"tid\":" << beh.thread << ",\"ts\":" << us(beh.start) << ",\"dur\":" << us(beh.end) - us(beh.start)
+            << ",\"args\":{\"id\":" << id << ",\"spawn_us\":" << us(beh.spawn->ts) << ",\"cowns\":[";
+        for (size_t i = 0; i < beh.spawn->count; ++i)
+          out << (i ? "," : "") << "\"" << escape(cown_names[beh.spawn->cowns[i]]) << "\"";
+        out << "]}}";
+
+        out << ",\n{\"name\":\"spawn\",\"cat\":\"spawn\",\"ph\":\"s\",\"pid\":0,\"id\":" << id
+            << ",\"tid\":" << beh.spawn_thread << ",\"ts\":" << us(beh.spawn->ts) << "}";
+        out << ",\n{\"name\":\"spawn\",\"cat\":\"spawn\",\"ph\":\"f\",\"bp\":\"e\",\"pid\":0,\"id\":" << id
+            << ",\"tid\":" << beh.thread << ",\"ts\":" << us(beh.start) << "}";
+      }
+      out << std::endl << "]" << std::endl;
+
+      buffers.clear();
+      cown_names.clear();
+      generation++;
+    }
+  };
+
+  inline void configure(opt::Opt& opt) { Tracer::get().configure(opt); }
+
+  inline void dump() { Tracer::get().dump(); }
+}
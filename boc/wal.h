@@ -0,0 +1,314 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <cpp/when.h>
+
+namespace boc::wal
+{
+  using verona::cpp::acquired_cown;
+  using verona::cpp::cown_ptr;
+  using verona::cpp::make_cown;
+  using verona::cpp::when;
+
+  /*
+   * A write-ahead log with group commit.
+   *
+   * - Behaviours append records to a buffer belonging to the worker they run on, so appending
+   *   only takes an uncontended lock.
+   * - Each record carries a completion that is called once the record is durable.
+   * - A flush is a behaviour on the log's flusher cown: it takes every buffered record, writes
+   *   them as one batch and calls fdatasync, then runs the completions of the batch.
+   *   Because flushes require the flusher cown they are serialised, records appended while a
+   *   flush is writing go into the next one.
+   * - A flush is scheduled when a record is appended while no flush is scheduled or running
+   *   (the flusher is idle), when batch records are pending, or explicitly with sync.  A flush
+   *   that ends with records pending schedules the next, so every record is flushed without
+   *   waiting for more appends, and records appended while a flush writes share the next one.
+   * - Each batch is written with a header holding its record count and a checksum, replay
+   *   stops at the first incomplete or corrupt batch and truncates the log there, so a batch
+   *   is either recovered entirely or not at all (and none of its completions were called).
+   * - Records are assigned increasing log sequence numbers when appended, a behaviour that
+   *   appends after another on the same cown gets a larger lsn, but batches are not sorted so
+   *   replay must not depend on the order of records from unrelated behaviours.
+   * - Records are written as raw bytes, so R must be trivially copyable.
+   * - If a write or fdatasync fails the log stops: the completions of that batch and of every
+   *   later record are never called and error() returns the errno of the failure.
+   * - The Log must outlive every behaviour that appends to or flushes it.
+   */
+
+  template<typename R>
+  class Log
+  {
+    static_assert(std::is_trivially_copyable_v<R>);
+
+  public:
+    using Completion = std::function<void()>;
+
+    struct Entry
+    {
+      uint64_t lsn;
+      R record;
+    };
+
+  private:
+    struct BatchHeader
+    {
+      uint32_t magic;
+      uint32_t count;
+      uint64_t checksum;
+    };
+
+    static constexpr uint32_t magic = 0xb0c10600;
+
+    struct Buffer
+    {
+      std::mutex lock;
+      std::vector<Entry> entries;
+      std::vector<Completion> completions;
+    };
+
+    struct Flusher
+    {
+      int fd;
+      int error = 0;
+      size_t flushes = 0;
+      size_t bytes = 0;
+      std::vector<Entry> entries;
+      std::vector<Completion> completions;
+
+      Flusher(int fd): fd(fd) {}
+
+      ~Flusher() { close(fd); }
+    };
+
+    static uint64_t checksum(const Entry* entries, size_t count) {
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(entries);
+      uint64_t h = 14695981039346656037ull;
+      for (size_t i = 0; i < count * sizeof(Entry); ++i)
+        h = (h ^ p[i]) * 1099511628211ull;
+      return h;
+    }
+
+    static std::atomic<uint64_t>& next_id() {
+      static std::atomic<uint64_t> id{1};
+      return id;
+    }
+
+    const uint64_t id;
+    const size_t batch;
+    std::atomic<uint64_t> lsn{0};
+    std::atomic<size_t> pending{0};
+    // flushes scheduled and not yet finished
+    std::atomic<size_t> flushing{0};
+    std::atomic<bool> flush_scheduled{false};
+    std::atomic<int> failed{0};
+    std::mutex lock;
+    std::unordered_map<std::thread::id, std::unique_ptr<Buffer>> buffers;
+    cown_ptr<Flusher> flusher;
+
+    // the buffer of the calling thread, cached for the last log it appended to
+    Buffer& local() {
+      thread_local uint64_t owner = 0;
+      thread_local Buffer* buffer = nullptr;
+      if (owner != id) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto& b = buffers[std::this_thread::get_id()];
+        if (!b)
+          b = std::make_unique<Buffer>();
+        buffer = b.get();
+        owner = id;
+      }
+      return *buffer;
+    }
+
+  public:
+    Log(const std::string& path, size_t batch, uint64_t start_lsn = 0)
+    : id(next_id()++), batch(batch), lsn(start_lsn) {
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd < 0)
+        throw std::runtime_error("cannot open log " + path + ": " + strerror(errno));
+      flusher = make_cown<Flusher>(fd);
+    }
+
+    Log(const Log&) = delete;
+
+    /*
+     * Appends a record, done is called once it is durable.  This must be called from the
+     * behaviour whose effects the record describes, while it holds the affected cowns.
+     */
+    uint64_t append(const R& record, Completion done) {
+      uint64_t n = ++lsn;
+      Buffer& b = local();
+      size_t p;
+      {
+        // counted before a flush can take the record, so the flush's decrement follows it
+        std::lock_guard<std::mutex> guard(b.lock);
+        p = ++pending;
+        b.entries.push_back(Entry{n, record});
+        b.completions.push_back(std::move(done));
+      }
+      // seq_cst against the end of a flush, so either this sees the flusher idle or the flush
+      // sees this record pending
+      if ((p >= batch || flushing == 0) && !flush_scheduled.exchange(true))
+        flush();
+      return n;
+    }
+
+    /*
+     * Flushes whatever has been appended so far.
+     */
+    void sync() {
+      flush_scheduled = true;
+      flush();
+    }
+
+    // the errno of the failed write or fdatasync that stopped the log, 0 if none has
+    int error() const { return failed; }
+
+    /*
+     * Calls f with the number of flushes and bytes written once every flush spawned so far
+     * has completed.
+     */
+    template<typename F>
+    void stats(F f) {
+      when(flusher) << [f = std::move(f)](acquired_cown<Flusher> flusher) mutable {
+        f(flusher->flushes, flusher->bytes);
+      };
+    }
+
+  private:
+    void flush() {
+      flushing++;
+      when(flusher) << [this](acquired_cown<Flusher> flusher) {
+        // appends from now on may schedule the next flush, which runs after this one
+        flush_scheduled = false;
+        write_batch(flusher);
+        if (--flushing == 0 && pending > 0 && !flush_scheduled.exchange(true))
+          flush();
+      };
+    }
+
+    void write_batch(acquired_cown<Flusher>& flusher) {
+      for (auto& b : buffers_snapshot()) {
+        std::lock_guard<std::mutex> guard(b->lock);
+        flusher->entries.insert(flusher->entries.end(), b->entries.begin(), b->entries.end());
+        std::move(b->completions.begin(), b->completions.end(), std::back_inserter(flusher->completions));
+        b->entries.clear();
+        b->completions.clear();
+      }
+
+      size_t count = flusher->entries.size();
+      if (count == 0)
+        return;
+      pending -= count;
+
+      // a stopped log drops its records, their completions are never called
+      if (flusher->error == 0) {
+        BatchHeader header{magic, uint32_t(count), checksum(flusher->entries.data(), count)};
+        flusher->error = write_all(flusher->fd, &header, sizeof(header));
+        if (flusher->error == 0)
+          flusher->error = write_all(flusher->fd, flusher->entries.data(), count * sizeof(Entry));
+        if (flusher->error == 0 && fdatasync(flusher->fd) != 0)
+          flusher->error = errno;
+      }
+      if (flusher->error != 0) {
+        failed = flusher->error;
+      } else {
+        flusher->flushes++;
+        flusher->bytes += sizeof(BatchHeader) + count * sizeof(Entry);
+        for (auto& done : flusher->completions)
+          done();
+      }
+      flusher->entries.clear();
+      flusher->completions.clear();
+    }
+
+    std::vector<Buffer*> buffers_snapshot() {
+      std::lock_guard<std::mutex> guard(lock);
+      std::vector<Buffer*> result;
+      for (auto& [thread, b] : buffers)
+        result.push_back(b.get());
+      return result;
+    }
+
+    // returns 0 or the errno of the failed write
+    static int write_all(int fd, const void* data, size_t size) {
+      const char* p = static_cast<const char*>(data);
+      while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0)
+          return errno;
+        p += n;
+        size -= size_t(n);
+      }
+      return 0;
+    }
+
+  public:
+    /*
+     * Calls f(entry) for every record of every complete batch in the log at path, in log order,
+     * then truncates any incomplete batch at the end.  Returns the largest lsn seen, so the log
+     * can be reopened with it.
+     */
+    template<typename F>
+    static uint64_t replay(const std::string& path, F f) {
+      int fd = open(path.c_str(), O_RDWR);
+      if (fd < 0)
+        return 0;
+
+      struct stat st;
+      if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error(std::string("cannot stat log: ") + strerror(errno));
+      }
+
+      uint64_t last = 0;
+      off_t valid = 0;
+      std::vector<Entry> entries;
+      while (true) {
+        BatchHeader header;
+        if (read(fd, &header, sizeof(header)) != ssize_t(sizeof(header)) || header.magic != magic)
+          break;
+        // a corrupt count must not size the read beyond what is left of the file
+        size_t size = size_t(header.count) * sizeof(Entry);
+        if (size > size_t(st.st_size - valid) - sizeof(header))
+          break;
+        entries.resize(header.count);
+        if (read(fd, entries.data(), size) != ssize_t(size) || checksum(entries.data(), header.count) != header.checksum)
+          break;
+        for (auto& e : entries) {
+          f(e);
+          last = std::max(last, e.lsn);
+        }
+        valid += off_t(sizeof(header) + size);
+      }
+
+      if (ftruncate(fd, valid) != 0) {
+        close(fd);
+        throw std::runtime_error(std::string("cannot truncate log: ") + strerror(errno));
+      }
+      close(fd);
+      return last;
+    }
+  };
+}
@@ -0,0 +1,138 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace boc
+{
+  /*
+   * Building blocks for benchmark workloads:
+   * - Rng, a xorshift64* generator, cheap enough to pick a key and an operation per request.
+   * - Zipf, keys in [0, n) with the zipfian distribution used by YCSB (Gray et al., Quickly
+   *   Generating Billion-Record Synthetic Databases), by default scrambled so the popular keys
+   *   are spread over the key space rather than all being the smallest keys.
+   * - Latencies, samples recorded into a buffer per thread and merged once the run is over
+   *   for percentiles.
+   */
+  class Rng
+  {
+    uint64_t state;
+
+  public:
+    explicit Rng(uint64_t seed): state(seed ? seed : 0x9e3779b97f4a7c15ull) {}
+
+    uint64_t next() {
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      return state * 0x2545f4914f6cdd1dull;
+    }
+
+    // uniform in [0, 1)
+    double uniform() { return double(next() >> 11) * 0x1.0p-53; }
+
+    // uniform in [0, n)
+    uint64_t below(uint64_t n) { return next() % n; }
+  };
+
+  class Zipf
+  {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    bool scramble;
+
+    static double zeta(uint64_t n, double theta) {
+      double sum = 0;
+      for (uint64_t i = 1; i <= n; ++i)
+        sum += 1.0 / std::pow(double(i), theta);
+      return sum;
+    }
+
+    static uint64_t fnv(uint64_t k) {
+      uint64_t h = 14695981039346656037ull;
+      for (int i = 0; i < 8; ++i) {
+        h = (h ^ (k & 0xff)) * 1099511628211ull;
+        k >>= 8;
+      }
+      return h;
+    }
+
+  public:
+    /*
+     * Computing the distribution is O(n), so build one Zipf and share it between clients.
+     */
+    Zipf(uint64_t n, double theta = 0.99, bool scramble = true)
+    : n(n), theta(theta), alpha(1.0 / (1.0 - theta)), zetan(zeta(n, theta)), scramble(scramble) {
+      eta = (1 - std::pow(2.0 / double(n), 1 - theta)) / (1 - zeta(2, theta) / zetan);
+    }
+
+    uint64_t operator()(Rng& rng) const {
+      double u = rng.uniform();
+      double uz = u * zetan;
+      uint64_t k;
+      if (uz < 1.0)
+        k = 0;
+      else if (uz < 1.0 + std::pow(0.5, theta))
+        k = 1;
+      else
+        k = std::min(n - 1, uint64_t(double(n) * std::pow(eta * u - eta + 1, alpha)));
+      return scramble ? fnv(k) % n : k;
+    }
+  };
+
+  class Latencies
+  {
+    static std::atomic<uint64_t>& next_id() {
+      static std::atomic<uint64_t> id{1};
+      return id;
+    }
+
+    const uint64_t id = next_id()++;
+    std::mutex lock;
+    std::vector<std::unique_ptr<std::vector<double>>> threads;
+
+    std::vector<double>& local() {
+      thread_local uint64_t owner = 0;
+      thread_local std::vector<double>* samples = nullptr;
+      if (owner != id) {
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(std::make_unique<std::vector<double>>());
+        samples = threads.back().get();
+        owner = id;
+      }
+      return *samples;
+    }
+
+  public:
+    void record(double sample) { local().push_back(sample); }
+
+    /*
+     * Every sample in order, only call this once nothing is recording.
+     */
+    std::vector<double> sorted() {
+      std::vector<double> all;
+      std::lock_guard<std::mutex> guard(lock);
+      for (auto& t : threads)
+        all.insert(all.end(), t->begin(), t->end());
+      std::sort(all.begin(), all.end());
+      return all;
+    }
+
+    // p in [0, 1], of samples returned by sorted
+    static double percentile(const std::vector<double>& sorted, double p) {
+      if (sorted.empty())
+        return 0;
+      return sorted[std::min(sorted.size() - 1, size_t(p * double(sorted.size())))];
+    }
+  };
+}
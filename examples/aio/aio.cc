@@ -0,0 +1,184 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/aio.h>
+#include <boc/bench.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace AsyncIO {
+  /*
+   * Random reads of block bytes from a file, by clients that each keep one read outstanding.
+   * A client is a cown, the read of each mode ends in a behaviour on the client that records
+   * it and issues the next one:
+   * - uring, the read goes to a boc::aio::Engine on io_uring and its completion is scheduled
+   *   on the client, no worker waits for the device
+   * - threads, the same through the Engine's pool of threads doing pread
+   * - blocking, pread is called in the client's behaviour, the worker waits for it
+   *
+   * Meanwhile background behaviours each compute for work_usec, the computation done while the
+   * reads run is the share of the workers the I/O leaves to other behaviours.
+   *
+   * The file's pages are dropped from the page cache before the run (unless --cached) so the
+   * reads reach the device.
+   */
+
+  struct Client {
+    boc::Rng rng;
+  };
+
+  std::string path = "/tmp/aio.dat";
+  size_t file_bytes = 256 << 20;
+  size_t block = 4096;
+  size_t reads = 100000;
+  size_t num_clients = 64;
+  size_t background = 4;
+  size_t work_usec = 20;
+  std::string mode = "uring";
+
+  int fd = -1;
+  std::unique_ptr<boc::aio::Engine> engine;
+  std::vector<cown_ptr<Client>> clients;
+  boc::Latencies latencies;
+  std::atomic<size_t> issued{0};
+  std::atomic<size_t> completed{0};
+  std::atomic<size_t> computed{0};
+  std::atomic<bool> done{false};
+
+  using Clock = std::chrono::steady_clock;
+
+  void next(cown_ptr<Client> self);
+
+  // records a read, false once every read is done
+  bool complete(Clock::time_point start, ssize_t result) {
+    check(result == ssize_t(block));
+    latencies.record(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    if (++completed < reads)
+      return true;
+    done = true;
+    if (engine)
+      engine->close();
+    clients.clear();
+    return false;
+  }
+
+  void issue(acquired_cown<Client>& client, cown_ptr<Client> self) {
+    if (issued++ >= reads)
+      return;
+    off_t offset = off_t(client->rng.below(file_bytes / block) * block);
+    auto start = Clock::now();
+
+    if (!engine) {
+      // the next read is a new behaviour, to let others run between the reads of a client
+      std::vector<char> buffer(block);
+      if (complete(start, pread(fd, buffer.data(), block, offset)))
+        next(std::move(self));
+      return;
+    }
+    engine->read(fd, offset, block, self, [self, start](acquired_cown<Client>& client, boc::aio::Result r) {
+      if (complete(start, r.result))
+        issue(client, self);
+    });
+  }
+
+  void next(cown_ptr<Client> self) {
+    when(self) << [self](acquired_cown<Client> client) { issue(client, self); };
+  }
+
+  void compute() {
+    verona::rt::schedule_lambda([]() {
+      if (done)
+        return;
+      busy_loop(work_usec);
+      computed++;
+      compute();
+    });
+  }
+
+  void create() {
+    int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+      throw std::runtime_error("cannot create " + path + ": " + strerror(errno));
+    boc::Rng rng(7);
+    std::vector<uint64_t> chunk((1 << 20) / sizeof(uint64_t));
+    for (size_t written = 0; written < file_bytes; written += chunk.size() * sizeof(uint64_t)) {
+      for (auto& w : chunk)
+        w = rng.next();
+      if (write(out, chunk.data(), chunk.size() * sizeof(uint64_t)) < 0)
+        throw std::runtime_error("cannot write " + path + ": " + strerror(errno));
+    }
+    fsync(out);
+    close(out);
+  }
+
+  void run(SystematicTestHarness* harness) {
+    if (mode != "blocking") {
+      auto backend = mode == "threads" ? boc::aio::Engine::Backend::threads : boc::aio::Engine::Backend::uring;
+      engine = std::make_unique<boc::aio::Engine>(num_clients, num_clients, backend);
+      for (size_t i = 0; i < engine->threads(); ++i)
+        harness->external_thread([]() { engine->serve(); });
+    }
+    if (reads == 0) {
+      if (engine)
+        engine->close();
+      return;
+    }
+
+    for (size_t i = 0; i < num_clients; ++i)
+      clients.push_back(make_cown<Client>(Client{boc::Rng(i + 1)}));
+    for (auto& c : clients)
+      next(c);
+    for (size_t i = 0; i < background; ++i)
+      compute();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  AsyncIO::path = harness.opt.is<const char*>("--file", AsyncIO::path.c_str());
+  AsyncIO::file_bytes = harness.opt.is<size_t>("--file_mb", AsyncIO::file_bytes >> 20) << 20;
+  AsyncIO::block = std::max<size_t>(harness.opt.is<size_t>("--block", AsyncIO::block), 1);
+  AsyncIO::reads = harness.opt.is<size_t>("--reads", AsyncIO::reads);
+  AsyncIO::num_clients = std::max<size_t>(harness.opt.is<size_t>("--clients", AsyncIO::num_clients), 1);
+  AsyncIO::background = harness.opt.is<size_t>("--background", harness.cores);
+  AsyncIO::work_usec = harness.opt.is<size_t>("--work_usec", AsyncIO::work_usec);
+  AsyncIO::mode = harness.opt.is<const char*>("--mode", AsyncIO::mode.c_str());
+  if (AsyncIO::mode != "uring" && AsyncIO::mode != "threads" && AsyncIO::mode != "blocking")
+    throw std::runtime_error("--mode is uring, threads or blocking");
+  if (AsyncIO::file_bytes < AsyncIO::block)
+    throw std::runtime_error("--file_mb is smaller than --block");
+
+  AsyncIO::create();
+  AsyncIO::fd = open(AsyncIO::path.c_str(), O_RDONLY);
+  if (AsyncIO::fd < 0)
+    throw std::runtime_error("cannot open " + AsyncIO::path + ": " + strerror(errno));
+  if (!harness.opt.has("--cached"))
+    posix_fadvise(AsyncIO::fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  AsyncIO::done = AsyncIO::reads == 0;
+  double t = boc::timed_run(harness, AsyncIO::run, &harness);
+  const char* backend = AsyncIO::engine ? AsyncIO::engine->name() : "blocking";
+  auto sorted = AsyncIO::latencies.sorted();
+  double busy = double(AsyncIO::computed) * double(AsyncIO::work_usec) / (t * 1e6 * double(harness.cores));
+  boc::Report()("mode", AsyncIO::mode)("backend", backend)("block", AsyncIO::block)("clients", AsyncIO::num_clients)
+    ("reads", AsyncIO::completed.load())("seconds", t)("reads_per_second", AsyncIO::completed / t)
+    ("p50_us", boc::Latencies::percentile(sorted, 0.5))("p99_us", boc::Latencies::percentile(sorted, 0.99))
+    ("background_per_second", AsyncIO::computed / t)("utilisation_rate", busy);
+
+  check(AsyncIO::completed == AsyncIO::reads);
+  AsyncIO::engine.reset();
+  close(AsyncIO::fd);
+  unlink(AsyncIO::path.c_str());
+}
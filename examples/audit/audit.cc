@@ -0,0 +1,184 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/aggregate.h>
+#include <boc/bench.h>
+
+using namespace verona::cpp;
+
+namespace Audit {
+  /*
+   * Auditing that a bank conserves money while transfers and deposits keep running.
+   *
+   * - Accounts belong to num_branches branches, account i to branch i % num_branches.
+   * - Every audit_every operations an audit reads the total of every branch and of the bank.
+   * - With --stop an audit is one when over every account, it has to wait for every queued
+   *   operation on any account and stops them all while it sums the balances.
+   * - Otherwise transfers and deposits publish their deltas to a boc::Aggregate and an
+   *   audit reads its shards instead, it never waits for the accounts.
+   * - Without --audit there are no audits and nothing is published, for the baseline
+   *   transfer throughput.
+   *
+   * At the end the aggregate totals are checked against the balances of the accounts.
+   */
+
+  struct Account {
+    int64_t balance;
+
+    Account(int64_t balance): balance(balance) {}
+  };
+
+  using Clock = std::chrono::steady_clock;
+
+  size_t num_accounts = 1 << 16;
+  size_t num_branches = 64;
+  size_t num_ops = 1 << 20;
+  size_t audit_every = 1 << 14;
+  size_t num_shards = 64;
+  int64_t initial_balance = 1000;
+  bool audit = false;
+  bool stop = false;
+
+  std::vector<cown_ptr<Account>> accounts;
+  std::unique_ptr<boc::Aggregate> aggregate;
+  std::atomic<int64_t> deposited{0};
+
+  std::mutex latencies_lock;
+  std::vector<double> latencies;
+
+  size_t branch(size_t account) { return account % num_branches; }
+
+  void transfer(size_t src, size_t dst, int64_t amount) {
+    when(accounts[src], accounts[dst]) << [src, dst, amount](acquired_cown<Account> s, acquired_cown<Account> d) {
+      if (s->balance < amount)
+        return;
+      s->balance -= amount;
+      d->balance += amount;
+      if (aggregate)
+        aggregate->publish({{branch(src), -amount}, {branch(dst), amount}});
+    };
+  }
+
+  void deposit(size_t dst, int64_t amount) {
+    when(accounts[dst]) << [dst, amount](acquired_cown<Account> d) {
+      d->balance += amount;
+      deposited += amount;
+      if (aggregate)
+        aggregate->publish({{branch(dst), amount}});
+    };
+  }
+
+  void record(Clock::time_point start) {
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    std::lock_guard<std::mutex> guard(latencies_lock);
+    latencies.push_back(ms);
+  }
+
+  void stop_the_world_audit() {
+    auto start = Clock::now();
+    when(read(cown_array<Account>(accounts.data(), accounts.size()))) << [start](acquired_cown_span<const Account> all) {
+      int64_t total = 0;
+      std::vector<int64_t> branches(num_branches, 0);
+      for (size_t i = 0; i < all.length; ++i) {
+        branches[branch(i)] += all[i]->balance;
+        total += all[i]->balance;
+      }
+      // no deposit can be running while every account is held
+      check(total == initial_balance * int64_t(num_accounts) + deposited);
+      record(start);
+    };
+  }
+
+  void aggregate_audit() {
+    auto start = Clock::now();
+    aggregate->read([start](const boc::Aggregate::Totals& totals) {
+      // transfers publish deltas that cancel, so the total only moves by deposits: it holds at
+      // least the initial balances and at most every deposit made so far, as a deposit is
+      // counted before its delta is published
+      int64_t initial = initial_balance * int64_t(num_accounts);
+      int64_t sum = 0;
+      for (auto k : totals.keys)
+        sum += k;
+      check(sum == totals.total);
+      check(totals.total >= initial);
+      check(totals.total <= initial + deposited);
+      record(start);
+    });
+  }
+
+  void run() {
+    accounts.clear();
+    for (size_t i = 0; i < num_accounts; ++i)
+      accounts.push_back(make_cown<Account>(initial_balance));
+    std::vector<int64_t> initial(num_branches, 0);
+    for (size_t i = 0; i < num_accounts; ++i)
+      initial[branch(i)] += initial_balance;
+    if (audit && !stop)
+      aggregate = std::make_unique<boc::Aggregate>(initial, num_shards);
+    deposited = 0;
+    latencies.clear();
+
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < num_ops; ++i) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      size_t src = x % num_accounts;
+      if (i % 16 == 0) {
+        deposit(src, int64_t(x % 100));
+      } else {
+        size_t dst = (src + 1 + (x >> 32) % (num_accounts - 1)) % num_accounts;
+        transfer(src, dst, int64_t(x % 100));
+      }
+
+      if (audit && (i + 1) % audit_every == 0) {
+        if (stop)
+          stop_the_world_audit();
+        else
+          aggregate_audit();
+      }
+    }
+
+    // every operation has published its deltas before this runs
+    when(read(cown_array<Account>(accounts.data(), accounts.size()))) << [](acquired_cown_span<const Account> all) {
+      std::vector<int64_t> branches(num_branches, 0);
+      for (size_t i = 0; i < all.length; ++i)
+        branches[branch(i)] += all[i]->balance;
+      accounts.clear();
+
+      if (!aggregate)
+        return;
+      aggregate->read([branches = std::move(branches)](const boc::Aggregate::Totals& totals) {
+        check(totals.keys == branches);
+        check(totals.total == initial_balance * int64_t(num_accounts) + deposited);
+        aggregate.reset();
+      });
+    };
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  Audit::num_accounts = harness.opt.is<size_t>("--accounts", Audit::num_accounts);
+  Audit::num_branches = harness.opt.is<size_t>("--branches", Audit::num_branches);
+  Audit::num_ops = harness.opt.is<size_t>("--ops", Audit::num_ops);
+  Audit::audit_every = harness.opt.is<size_t>("--audit_every", Audit::audit_every);
+  Audit::num_shards = harness.opt.is<size_t>("--shards", Audit::num_shards);
+  Audit::audit = harness.opt.has("--audit");
+  Audit::stop = harness.opt.has("--stop");
+
+  double t = boc::timed_run(harness, Audit::run);
+
+  auto& l = Audit::latencies;
+  std::sort(l.begin(), l.end());
+  double mean = 0;
+  for (auto ms : l)
+    mean += ms / l.size();
+  boc::Report()("mode", !Audit::audit ? "none" : Audit::stop ? "stop" : "aggregate")("shards", Audit::num_shards)
+    ("audits", l.size())("audit_mean_ms", mean)("audit_max_ms", l.empty() ? 0.0 : l.back())
+    ("seconds", t)("ops_per_second", Audit::num_ops / t);
+}
@@ -112,6 +112,56 @@ namespace Bank
     }
   }
 
+  namespace MultiTransfer {
+    /*
+     * - A when can also require a set of cowns whose size is only known at runtime, by
+     *   passing a cown_array that refers to a contiguous sequence of cown_ptrs.
+     * - The behaviour receives an acquired_cown_span with one acquired_cown per cown
+     *   in the array, in the same order.
+     * - cown_arrays and individual cowns can be mixed in the same when, and read can be
+     *   applied to a cown_array to acquire all of its cowns as read-only.
+     *
+     * - This transfer collects amount from each of an arbitrary number of accounts into dst,
+     *   either every src pays or none of them do.
+     */
+    void transfer(std::vector<cown_ptr<Account>> srcs, cown_ptr<Account> dst, int amount) {
+      when(dst, cown_array<Account>(srcs.data(), srcs.size())) << [amount](acquired_cown<Account> dst, acquired_cown_span<Account> srcs) {
+        if (dst->frozen)
+          return;
+
+        for (auto& src : srcs)
+          if (src->balance < amount || src->frozen)
+            return;
+
+        for (auto& src : srcs) {
+          src->balance -= amount;
+          dst->balance += amount;
+        }
+      };
+    }
+
+    void run() {
+      size_t n = 10;
+      std::vector<cown_ptr<Account>> srcs;
+      for (size_t i = 0; i < n; ++i)
+        srcs.push_back(make_cown<Account>(100));
+      cown_ptr<Account> dst = make_cown<Account>(0);
+
+      transfer(srcs, dst, 20);
+
+      // a second src set where one account cannot pay, so nothing is moved
+      std::vector<cown_ptr<Account>> poor(srcs);
+      poor.push_back(make_cown<Account>(10));
+      transfer(poor, dst, 20);
+
+      when(read(cown_array<Account>(srcs.data(), srcs.size())), read(dst)) << [n](acquired_cown_span<const Account> srcs, acquired_cown<const Account> dst) {
+        for (auto& src : srcs)
+          check(src->balance == 80);
+        check(dst->balance == int(n) * 20);
+      };
+    }
+  }
+
   namespace OrderingOperations {
     /*
      * - Behaviours are dispatched according to an implicit happens before order.
@@ -194,6 +244,7 @@ namespace Bank
 
   void run() {
     AtomicTransfer::run();
+    MultiTransfer::run();
     OrderingOperations::run();
     OrderingLogging::run();
   }
@@ -0,0 +1,479 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace BankServer {
+  /*
+   * The bank served over a socket, a Unix domain socket or TCP on the loopback interface:
+   * - a poller thread waits on epoll for the listening socket and the connections, every
+   *   connection is a cown and its readiness is handled in a behaviour on it
+   * - a behaviour reads everything the connection has buffered and parses all the complete
+   *   requests at once, each becomes a transfer, a when over the two accounts as in
+   *   Bank::AtomicTransfer
+   * - a transfer sends its response back to the connection in a behaviour on it, responses
+   *   are reordered by sequence number so they are written in request order, and they are
+   *   written together once no request parsed so far is still running (or 64KiB are waiting),
+   *   so a client that pipelines requests gets its responses in batches
+   * - connections are registered EPOLLONESHOT and re-armed by the behaviour handling them, so
+   *   the poller never spawns a second read while one is pending
+   *
+   * The load generator is in the same process: client threads drive connections that each
+   * keep pipeline requests outstanding until requests have been answered in total, recording
+   * the latency of each.  Once they are done and the connections are closed the server stops
+   * and the accounts are checked to hold all the money they started with.
+   */
+
+  struct Request {
+    uint32_t src;
+    uint32_t dst;
+    int64_t amount;
+  };
+
+  struct Response {
+    int64_t balance;
+    uint32_t ok;
+    uint32_t pad;
+  };
+
+  struct Account {
+    int64_t balance;
+
+    Account(int64_t balance): balance(balance) {}
+  };
+
+  struct Connection {
+    int fd;
+    std::vector<char> in;
+    uint64_t parsed = 0;
+    uint64_t answered = 0;
+    std::deque<std::optional<Response>> pending;
+    std::vector<char> out;
+    bool want_out = false;
+    bool eof = false;
+    bool closed = false;
+
+    Connection(int fd): fd(fd) {}
+  };
+
+  size_t num_accounts = 1000;
+  int64_t initial_balance = 1000;
+  size_t num_connections = 64;
+  size_t pipeline = 16;
+  size_t num_requests = 1000000;
+  size_t client_threads = 4;
+  std::string unix_path = "/tmp/bankserver.sock";
+  uint16_t tcp_port = 0;
+
+  std::vector<cown_ptr<Account>> accounts;
+  int epfd = -1;
+  int listener = -1;
+  int wake = -1;
+
+  // connections the behaviours have finished with, closed by the poller
+  std::mutex lock;
+  std::vector<int> finished;
+  bool stopping = false;
+
+  void signal() {
+    uint64_t one = 1;
+    UNUSED(write(wake, &one, sizeof(one)));
+  }
+
+  void rearm(Connection& conn) {
+    epoll_event ev{};
+    ev.events = EPOLLONESHOT | (conn.eof ? 0 : EPOLLIN) | (conn.want_out ? EPOLLOUT : 0);
+    ev.data.fd = conn.fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+  }
+
+  void finish(Connection& conn) {
+    if (conn.closed)
+      return;
+    conn.closed = true;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn.fd, nullptr);
+    std::lock_guard<std::mutex> guard(lock);
+    finished.push_back(conn.fd);
+    signal();
+  }
+
+  void flush(Connection& conn) {
+    size_t sent = 0;
+    while (sent < conn.out.size()) {
+      ssize_t n = send(conn.fd, conn.out.data() + sent, conn.out.size() - sent, MSG_NOSIGNAL);
+      if (n > 0) {
+        sent += size_t(n);
+        continue;
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      // the client has gone, drop what it will never read
+      conn.eof = true;
+      sent = conn.out.size();
+    }
+    conn.out.erase(conn.out.begin(), conn.out.begin() + sent);
+
+    bool blocked = !conn.out.empty();
+    if (blocked != conn.want_out) {
+      conn.want_out = blocked;
+      if (!conn.closed)
+        rearm(conn);
+    }
+    if (conn.eof && conn.out.empty() && conn.answered == conn.parsed)
+      finish(conn);
+  }
+
+  void reply(Connection& conn, uint64_t seq, Response r) {
+    conn.pending[seq - conn.answered] = r;
+    while (!conn.pending.empty() && conn.pending.front()) {
+      auto bytes = reinterpret_cast<const char*>(&*conn.pending.front());
+      conn.out.insert(conn.out.end(), bytes, bytes + sizeof(Response));
+      conn.pending.pop_front();
+      conn.answered++;
+    }
+    if (conn.answered == conn.parsed || conn.out.size() >= (64 << 10))
+      flush(conn);
+  }
+
+  void transfer(cown_ptr<Connection> c, uint64_t seq, Request req) {
+    when(accounts[req.src], accounts[req.dst]) << [c, seq, req](acquired_cown<Account> src, acquired_cown<Account> dst) {
+      Response r{src->balance, 0, 0};
+      if (src->balance >= req.amount && req.amount >= 0) {
+        src->balance -= req.amount;
+        dst->balance += req.amount;
+        r = Response{src->balance, 1, 0};
+      }
+      when(c) << [seq, r](acquired_cown<Connection> conn) { reply(*conn, seq, r); };
+    };
+  }
+
+  void receive(Connection& conn, cown_ptr<Connection> c) {
+    static thread_local std::vector<char> buffer(64 << 10);
+    for (;;) {
+      ssize_t n = read(conn.fd, buffer.data(), buffer.size());
+      if (n > 0) {
+        conn.in.insert(conn.in.end(), buffer.data(), buffer.data() + n);
+        continue;
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        conn.eof = true;
+      break;
+    }
+
+    size_t count = conn.in.size() / sizeof(Request);
+    for (size_t i = 0; i < count; ++i) {
+      Request req;
+      memcpy(&req, conn.in.data() + i * sizeof(Request), sizeof(Request));
+      uint64_t seq = conn.parsed++;
+      conn.pending.emplace_back();
+      if (req.src >= num_accounts || req.dst >= num_accounts || req.src == req.dst)
+        reply(conn, seq, Response{0, 0, 0});
+      else
+        transfer(c, seq, req);
+    }
+    conn.in.erase(conn.in.begin(), conn.in.begin() + count * sizeof(Request));
+  }
+
+  void service(cown_ptr<Connection> c, uint32_t events) {
+    when(c) << [c, events](acquired_cown<Connection> conn) {
+      if (conn->closed)
+        return;
+      if (events & EPOLLOUT)
+        flush(*conn);
+      if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        receive(*conn, c);
+      if (conn->eof)
+        flush(*conn);
+      if (!conn->closed)
+        rearm(*conn);
+    };
+  }
+
+  void accept_all(std::unordered_map<int, cown_ptr<Connection>>& connections) {
+    for (;;) {
+      int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0)
+        return;
+      if (tcp_port != 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      }
+      connections.emplace(fd, make_cown<Connection>(fd));
+      epoll_event ev{};
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.fd = fd;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+  }
+
+  void audit() {
+    when(cown_array<Account>(accounts.data(), accounts.size())) << [](acquired_cown_span<Account> all) {
+      int64_t total = 0;
+      for (auto& account : all) {
+        check(account->balance >= 0);
+        total += account->balance;
+      }
+      check(total == initial_balance * int64_t(num_accounts));
+      // cowns must not outlive the run
+      accounts.clear();
+    };
+  }
+
+  void poll() {
+    std::unordered_map<int, cown_ptr<Connection>> connections;
+    epoll_event events[256];
+    for (;;) {
+      int n = epoll_wait(epfd, events, 256, -1);
+      for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == listener) {
+          accept_all(connections);
+        } else if (fd == wake) {
+          uint64_t count;
+          UNUSED(read(wake, &count, sizeof(count)));
+        } else {
+          auto it = connections.find(fd);
+          if (it != connections.end())
+            service(it->second, events[i].events);
+        }
+      }
+
+      std::lock_guard<std::mutex> guard(lock);
+      for (int fd : finished) {
+        connections.erase(fd);
+        close(fd);
+      }
+      finished.clear();
+      if (stopping && connections.empty())
+        break;
+    }
+
+    close(listener);
+    close(epfd);
+    close(wake);
+    if (tcp_port == 0)
+      unlink(unix_path.c_str());
+    audit();
+    verona::rt::Scheduler::remove_external_event_source();
+  }
+
+  int connect_server() {
+    int fd;
+    if (tcp_port != 0) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(tcp_port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        throw std::runtime_error(std::string("cannot connect: ") + strerror(errno));
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, unix_path.c_str(), sizeof(addr.sun_path) - 1);
+      if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        throw std::runtime_error("cannot connect to " + unix_path + ": " + strerror(errno));
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+  }
+
+  void listen_server() {
+    if (tcp_port != 0) {
+      listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      int one = 1;
+      setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(tcp_port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        throw std::runtime_error("cannot bind port " + std::to_string(tcp_port) + ": " + strerror(errno));
+    } else {
+      listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, unix_path.c_str(), sizeof(addr.sun_path) - 1);
+      unlink(unix_path.c_str());
+      if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        throw std::runtime_error("cannot bind " + unix_path + ": " + strerror(errno));
+    }
+    if (listen(listener, SOMAXCONN) < 0)
+      throw std::runtime_error(std::string("cannot listen: ") + strerror(errno));
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    for (int fd : {listener, wake}) {
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+  }
+
+  // the load generator
+
+  struct Client {
+    int fd;
+    boc::Rng rng;
+    std::vector<char> out;
+    std::vector<char> in;
+    std::deque<std::chrono::steady_clock::time_point> sent;
+    bool done = false;
+  };
+
+  std::atomic<size_t> claimed{0};
+  std::atomic<size_t> answered{0};
+  std::atomic<size_t> succeeded{0};
+  std::atomic<size_t> clients_running{0};
+  boc::Latencies latencies;
+
+  void send_requests(Client& c) {
+    size_t want = pipeline - c.sent.size();
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < want && claimed++ < num_requests; ++i) {
+      uint32_t src = uint32_t(c.rng.below(num_accounts));
+      uint32_t dst = uint32_t((src + 1 + c.rng.below(num_accounts - 1)) % num_accounts);
+      Request req{src, dst, int64_t(c.rng.below(100))};
+      auto bytes = reinterpret_cast<const char*>(&req);
+      c.out.insert(c.out.end(), bytes, bytes + sizeof(req));
+      c.sent.push_back(now);
+    }
+
+    size_t written = 0;
+    while (written < c.out.size()) {
+      ssize_t n = write(c.fd, c.out.data() + written, c.out.size() - written);
+      if (n <= 0)
+        break;
+      written += size_t(n);
+    }
+    c.out.erase(c.out.begin(), c.out.begin() + written);
+  }
+
+  void load(size_t index) {
+    std::vector<Client> clients;
+    for (size_t i = index; i < num_connections; i += client_threads)
+      clients.push_back(Client{connect_server(), boc::Rng(i + 1), {}, {}, {}});
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < clients.size(); ++i) {
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.u64 = i;
+      epoll_ctl(ep, EPOLL_CTL_ADD, clients[i].fd, &ev);
+      send_requests(clients[i]);
+    }
+
+    size_t open = clients.size();
+    epoll_event events[256];
+    char buffer[64 << 10];
+    while (open > 0) {
+      int n = epoll_wait(ep, events, 256, 100);
+      for (int e = 0; e < n; ++e) {
+        Client& c = clients[events[e].data.u64];
+        ssize_t got = read(c.fd, buffer, sizeof(buffer));
+        if (got <= 0) {
+          check(got < 0 && (errno == EAGAIN || errno == EINTR));
+          continue;
+        }
+        c.in.insert(c.in.end(), buffer, buffer + got);
+
+        size_t count = c.in.size() / sizeof(Response);
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+          Response r;
+          memcpy(&r, c.in.data() + i * sizeof(Response), sizeof(Response));
+          succeeded += r.ok;
+          latencies.record(std::chrono::duration<double, std::micro>(now - c.sent.front()).count());
+          c.sent.pop_front();
+        }
+        c.in.erase(c.in.begin(), c.in.begin() + count * sizeof(Response));
+        answered += count;
+        send_requests(c);
+      }
+
+      // a connection is done once no request remains to claim and its answers are in
+      for (auto& c : clients) {
+        if (!c.done && c.sent.empty() && claimed >= num_requests) {
+          c.done = true;
+          close(c.fd);
+          open--;
+        } else if (!c.done && !c.out.empty()) {
+          send_requests(c);
+        }
+      }
+    }
+    close(ep);
+
+    if (--clients_running == 0) {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+      signal();
+    }
+  }
+
+  void run(SystematicTestHarness* harness) {
+    accounts.clear();
+    for (size_t i = 0; i < num_accounts; ++i)
+      accounts.push_back(make_cown<Account>(initial_balance));
+
+    listen_server();
+    verona::rt::Scheduler::add_external_event_source();
+    harness->external_thread([]() { poll(); });
+    clients_running = client_threads;
+    for (size_t i = 0; i < client_threads; ++i)
+      harness->external_thread([i]() { load(i); });
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  BankServer::num_accounts = std::max<size_t>(harness.opt.is<size_t>("--accounts", BankServer::num_accounts), 2);
+  BankServer::num_connections = std::max<size_t>(harness.opt.is<size_t>("--connections", BankServer::num_connections), 1);
+  BankServer::pipeline = std::max<size_t>(harness.opt.is<size_t>("--pipeline", BankServer::pipeline), 1);
+  BankServer::num_requests = harness.opt.is<size_t>("--requests", BankServer::num_requests);
+  BankServer::client_threads = std::min(BankServer::num_connections,
+    std::max<size_t>(harness.opt.is<size_t>("--client_threads", BankServer::client_threads), 1));
+  BankServer::unix_path = harness.opt.is<const char*>("--unix", BankServer::unix_path.c_str());
+  BankServer::tcp_port = uint16_t(harness.opt.is<size_t>("--tcp", 0));
+
+  double t = boc::timed_run(harness, BankServer::run, &harness);
+  auto sorted = BankServer::latencies.sorted();
+  boc::Report()("transport", BankServer::tcp_port ? "tcp" : "unix")("connections", BankServer::num_connections)
+    ("pipeline", BankServer::pipeline)("requests", BankServer::answered.load())("seconds", t)
+    ("requests_per_second", BankServer::answered / t)("p50_us", boc::Latencies::percentile(sorted, 0.5))
+    ("p99_us", boc::Latencies::percentile(sorted, 0.99));
+
+  check(BankServer::answered == BankServer::num_requests);
+}
@@ -1,11 +1,13 @@
 // Copyright Microsoft and Project Verona Contributors.
 // SPDX-License-Identifier: MIT
+#include <algorithm>
 #include <memory>
 #include <debug/harness.h>
 #include <cpp/when.h>
 #include <cmath>
 #include <random>
 #include <SFML/Graphics.hpp>
+#include <boc/profiler.h>
 
 /* Based on https://vergenet.net/~conrad/boids/pseudocode.html
  * with parameter tweaks and modifications to split boid
@@ -100,46 +102,43 @@ const int vlim = 20;
 static size_t work_usec = 10000;
 
 template<typename To, typename From>
-using AccessOp = cown_ptr<To> (*)(cown_ptr<From>);
+using AccessOp = cown_array<To> (*)(cown_array<From>);
 
 template<typename T>
-constexpr cown_ptr<T> write(cown_ptr<T> o) { return o; }
+cown_array<T> write(cown_array<T> o) { return o; }
 
-template<typename T, size_t>
-using acquired = acquired_cown<T>;
+/* The flock is held in a runtime sized vector, each behaviour that needs every boid
+ * acquires them all through a single cown_array rather than a compile time pack
+ */
+using Flock = std::vector<cown_ptr<Boid>>;
 
-template<size_t n, std::size_t... I, typename To, typename From>
-void compute_partial_results_impl(AccessOp<To, From> op, std::array<cown_ptr<Result>, n>& results,  std::array<cown_ptr<Boid>, n>& boids, std::index_sequence<I...>) {
+template<typename To, typename From>
+void compute_partial_results(AccessOp<To, From> op, std::vector<cown_ptr<Result>>& results, Flock& boids) {
+  size_t n = boids.size();
   for (size_t i = 0; i < n; ++i) {
-    when(results[i], op(std::get<I>(boids))...) << [i](acquired_cown<Result> partial_result, acquired<To, I>... acquired){
-      std::array<acquired_cown<To>*, n> boids {{ (&acquired)... }};
-      for (size_t j = 0; j < n; ++j) {
+    when(results[i], op(cown_array<Boid>(boids.data(), n))) << boc::profile::track("partial", [i](acquired_cown<Result> partial_result, acquired_cown_span<To> boids){
+      for (size_t j = 0; j < boids.length; ++j) {
         if (i != j) {
           // Rule 1: collect sum of boid positions
-          std::get<0>(*partial_result) += (*boids[j])->position;
+          std::get<0>(*partial_result) += boids[j]->position;
 
           // Rule 2: If the boid is 'close' (here within 30) then
           // collect the (displacement * 2) to move boid away from these other boids
-          Vector diff = (*boids[j])->position - (*boids[i])->position;
+          Vector diff = boids[j]->position - boids[i]->position;
           if (diff.abs() < 30) std::get<1>(*partial_result) -= diff;
 
           // Rule 3: Collect the velocity of boids in the flock
-          std::get<2>(*partial_result) += (*boids[j])->velocity;
+          std::get<2>(*partial_result) += boids[j]->velocity;
         }
       }
-    };
+    });
   }
 }
 
-template<std::size_t n, typename Indices = std::make_index_sequence<n>, typename To, typename From>
-void compute_partial_results(AccessOp<To, From> op, std::array<cown_ptr<Result>, n>& results, std::array<cown_ptr<Boid>, n>& boids) {
-  compute_partial_results_impl(op, results, boids, Indices{});
-}
-
-template<size_t n>
-void update_boid_positions(std::array<cown_ptr<Result>, n>& results, std::array<cown_ptr<Boid>, n>& boids) {
+void update_boid_positions(std::vector<cown_ptr<Result>>& results, Flock& boids) {
+  size_t n = boids.size();
   for (size_t i = 0; i < n; ++i) {
-    when(results[i], boids[i]) << [i](acquired_cown<Result> partial_result, acquired_cown<Boid> boid){
+    when(results[i], boids[i]) << boc::profile::track("update", [n](acquired_cown<Result> partial_result, acquired_cown<Boid> boid){
       // This behaviour calculates the velocity update for a particular
       // boid based on the global information
 
@@ -183,7 +182,7 @@ void update_boid_positions(std::array<cown_ptr<Result>, n>& results, std::array<
         boid->velocity = (v / v.abs()) * vlim;
       }
       boid->position += v;
-    };
+    });
   }
 }
 
@@ -199,56 +198,59 @@ void draw_boid(acquired_cown<sf::RenderWindow>& window, acquired_cown<To>& boid)
   window->draw(shape);
 }
 
-template<size_t n, std::size_t... I, typename To, typename From>
-void step_impl(AccessOp<To, From> op, cown_ptr<sf::RenderWindow> window, std::array<cown_ptr<Boid>, n> boids, std::index_sequence<I...>) {
-  when() << [op, window, boids]() mutable {
-    std::array<cown_ptr<Result>, n> partial_results =  {{ (static_cast<void>(I), make_cown<Result>(Vector{0, 0}, Vector{0, 0}, Vector{0, 0}))... }};
+/* frames is the number of frames left to draw, or 0 to run until killed */
+template<typename To, typename From>
+void step(AccessOp<To, From> op, cown_ptr<sf::RenderWindow> window, Flock boids, size_t frames) {
+  when() << boc::profile::track("step", [op, window, boids = std::move(boids), frames]() mutable {
+    std::vector<cown_ptr<Result>> partial_results;
+    for (size_t i = 0; i < boids.size(); ++i)
+      partial_results.push_back(make_cown<Result>(Vector{0, 0}, Vector{0, 0}, Vector{0, 0}));
     compute_partial_results(op, partial_results, boids);
     update_boid_positions(partial_results, boids);
 
-    when(window, op(std::get<I>(boids))...) << [](acquired_cown<sf::RenderWindow> window, acquired<To, I>... acquired){
+    when(window, op(cown_array<Boid>(boids.data(), boids.size()))) << boc::profile::track("draw", [](acquired_cown<sf::RenderWindow> window, acquired_cown_span<To> boids){
       window->clear();
-      (draw_boid(window, acquired), ...);
+      for (auto& boid : boids)
+        draw_boid(window, boid);
       window->display();
-    };
-
-    step(op, window, boids);
-  };
-}
+    });
 
-template<std::size_t n, typename Indices = std::make_index_sequence<n>, typename To, typename From>
-void step(AccessOp<To, From> op, cown_ptr<sf::RenderWindow> window, std::array<cown_ptr<Boid>, n> boids) {
-  step_impl(op, window, boids, Indices{});
+    if (frames != 1)
+      step(op, window, std::move(boids), frames == 0 ? 0 : frames - 1);
+  });
 }
 
-template<size_t n, std::size_t... I, typename To, typename From>
-void run_impl(AccessOp<To, From> op, std::index_sequence<I...> is) {
+template<typename To, typename From>
+void run_impl(AccessOp<To, From> op, size_t n, size_t frames) {
   std::default_random_engine gen;
   std::uniform_int_distribution<int> x_dist(0, width - 1);
   std::uniform_int_distribution<int> y_dist(0, height - 1);
 
-  // static cast inside tuple to unpack the parameters
-  std::array<cown_ptr<Boid>, n> boids = {{ (static_cast<void>(I), make_cown<Boid>(Vector{double(x_dist(gen)), double(y_dist(gen))}))... }};
+  Flock boids;
+  for (size_t i = 0; i < n; ++i)
+    boids.push_back(make_cown<Boid>(Vector{double(x_dist(gen)), double(y_dist(gen))}));
   auto window = make_cown<sf::RenderWindow>(sf::VideoMode(width, height), "Boids");
-  step(op, window, boids);
+  step(op, window, std::move(boids), frames);
 }
 
-template<std::size_t n, typename Indices = std::make_index_sequence<n>>
-void run_read() {
-  run_impl<n>(&read<Boid>, Indices{});
+void run_read(size_t n, size_t frames) {
+  run_impl(&read<Boid>, n, frames);
 }
 
-template<std::size_t n, typename Indices = std::make_index_sequence<n>>
-void run_write() {
-  run_impl<n>(&write<Boid>, Indices{});
+void run_write(size_t n, size_t frames) {
+  run_impl(&write<Boid>, n, frames);
 }
 
 int main(int argc, char** argv)
 {
   SystematicTestHarness harness(argc, argv);
-  constexpr size_t num_boids = 50;
+  // the rules average over the other boids, so there must be at least two
+  size_t num_boids = std::max<size_t>(harness.opt.is<size_t>("--boids", 50), 2);
+  size_t frames = harness.opt.is<size_t>("--frames", 0);
+  boc::trace::configure(harness.opt);
   if (harness.opt.has("--ro"))
-    harness.run(run_read<num_boids>);
+    harness.run(run_read, num_boids, frames);
   else
-    harness.run(run_write<num_boids>);
+    harness.run(run_write, num_boids, frames);
+  boc::trace::dump();
 }
\ No newline at end of file
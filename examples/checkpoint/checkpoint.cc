@@ -0,0 +1,166 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/checkpoint.h>
+
+using namespace verona::cpp;
+
+namespace Checkpoint {
+  /*
+   * Restarting a bank from a checkpoint rather than replaying its transfers:
+   * - run creates the accounts, spawns num_transfers random transfers and takes a checkpoint
+   *   part way through, so transfers keep running while the accounts are copied a range at
+   *   a time
+   * - each transfer reads the checkpoint epoch when it starts and preserves the balances it
+   *   is about to change, so the checkpoint is of a single cut and its total is unchanged
+   * - restart maps the checkpoint and serves a transfer, creating only the two cowns it
+   *   needs, or with --eager every cown first
+   *
+   * The rate of transfers while the checkpoint is taken is reported as
+   * checkpoint_transfers_per_second, and the time from starting the restart to the first
+   * transfer completing as first_transfer_ms.
+   */
+
+  struct Account {
+    int64_t balance;
+
+    Account(int64_t balance): balance(balance) {}
+  };
+
+  using Writer = boc::checkpoint::Writer<Account>;
+  using Image = boc::checkpoint::Image<Account>;
+  using Cowns = boc::checkpoint::Cowns<Account>;
+  using Clock = std::chrono::steady_clock;
+
+  size_t num_accounts = 1 << 20;
+  size_t num_transfers = 1 << 20;
+  size_t range = 4096;
+  int64_t initial_balance = 1000;
+  bool eager = false;
+  std::string path = "accounts.ckpt";
+
+  std::vector<cown_ptr<Account>> accounts;
+  std::unique_ptr<Writer> writer;
+  std::atomic<size_t> transferred{0};
+  double checkpoint_ms = 0;
+  double transfers_per_second = 0;
+  std::optional<std::string> failed;
+
+  void transfer(size_t src, size_t dst, int64_t amount) {
+    when(accounts[src], accounts[dst]) << [src, dst, amount](acquired_cown<Account> s, acquired_cown<Account> d) {
+      if (s->balance < amount)
+        return;
+      uint64_t epoch = writer->epoch();
+      writer->preserve(epoch, src, *s);
+      writer->preserve(epoch, dst, *d);
+      s->balance -= amount;
+      d->balance += amount;
+      transferred++;
+    };
+  }
+
+  void transfers(uint64_t& x, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      size_t src = x % num_accounts;
+      size_t dst = (src + 1 + (x >> 32) % (num_accounts - 1)) % num_accounts;
+      transfer(src, dst, int64_t(x % 100));
+    }
+  }
+
+  void run() {
+    accounts.clear();
+    for (size_t i = 0; i < num_accounts; ++i)
+      accounts.push_back(make_cown<Account>(initial_balance));
+    writer = std::make_unique<Writer>(num_accounts);
+    transferred = 0;
+
+    uint64_t x = 88172645463325252ull;
+    transfers(x, num_transfers / 2);
+
+    // run is called before the scheduler starts, so the checkpoint is started and timed from
+    // a behaviour
+    verona::rt::schedule_lambda([]() {
+      auto start = Clock::now();
+      size_t before = transferred;
+      writer->take(path, range, [](size_t i) { return accounts[i]; }, [start, before](std::optional<std::string> error) {
+        failed = std::move(error);
+        checkpoint_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        transfers_per_second = checkpoint_ms > 0 ? (transferred - before) / (checkpoint_ms / 1000) : 0.0;
+        // the remaining transfers hold the cowns they need, cowns must not outlive the run
+        accounts.clear();
+      });
+    });
+
+    transfers(x, num_transfers - num_transfers / 2);
+  }
+
+  std::unique_ptr<Image> image;
+  std::unique_ptr<Cowns> lazy;
+  double first_transfer_ms = 0;
+  size_t created = 0;
+
+  void restart() {
+    auto start = Clock::now();
+    image = std::make_unique<Image>(path);
+
+    cown_ptr<Account> src, dst;
+    if (eager) {
+      for (size_t i = 0; i < image->size(); ++i)
+        accounts.push_back(make_cown<Account>((*image)[i]));
+      src = accounts[0];
+      dst = accounts[image->size() - 1];
+    } else {
+      lazy = std::make_unique<Cowns>(*image);
+      src = (*lazy)[0];
+      dst = (*lazy)[image->size() - 1];
+    }
+
+    when(src, dst) << [start](acquired_cown<Account> s, acquired_cown<Account> d) {
+      s->balance -= 1;
+      d->balance += 1;
+      first_transfer_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+      created = eager ? accounts.size() : lazy->created();
+      accounts.clear();
+      lazy.reset();
+    };
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  Checkpoint::num_accounts = harness.opt.is<size_t>("--accounts", Checkpoint::num_accounts);
+  Checkpoint::num_transfers = harness.opt.is<size_t>("--transfers", Checkpoint::num_transfers);
+  Checkpoint::range = harness.opt.is<size_t>("--range", Checkpoint::range);
+  Checkpoint::path = harness.opt.is<const char*>("--file", Checkpoint::path.c_str());
+  Checkpoint::eager = harness.opt.has("--eager");
+
+  if (!harness.opt.has("--restart")) {
+    double t = boc::timed_run(harness, Checkpoint::run);
+    if (Checkpoint::failed) {
+      std::cerr << *Checkpoint::failed << std::endl;
+      return 1;
+    }
+    boc::Report()("phase", "checkpoint")("accounts", Checkpoint::num_accounts)("range", Checkpoint::range)
+      ("checkpoint_ms", Checkpoint::checkpoint_ms)("checkpoint_transfers_per_second", Checkpoint::transfers_per_second)
+      ("seconds", t)("peak_rss_kb", boc::peak_rss_kb());
+  }
+
+  double t = boc::timed_run(harness, Checkpoint::restart);
+  boc::Report()("phase", "restart")("mode", Checkpoint::eager ? "eager" : "lazy")("accounts", Checkpoint::image->size())
+    ("created", Checkpoint::created)("first_transfer_ms", Checkpoint::first_transfer_ms)("seconds", t);
+
+  // the checkpoint is of a consistent cut, so no money was created or lost
+  int64_t total = 0;
+  for (size_t i = 0; i < Checkpoint::image->size(); ++i)
+    total += (*Checkpoint::image)[i].balance;
+  check(total == Checkpoint::initial_balance * int64_t(Checkpoint::image->size()));
+}
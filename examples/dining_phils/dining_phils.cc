@@ -3,6 +3,7 @@
 #include <memory>
 #include <debug/harness.h>
 #include <cpp/when.h>
+#include <boc/profiler.h>
 
 using namespace verona::cpp;
 
@@ -29,21 +30,24 @@ namespace DiningPhils {
     cown_ptr<Fork> left;
     cown_ptr<Fork> right;
     size_t hunger;
+    boc::profile::Tag left_tag;
+    boc::profile::Tag right_tag;
 
-    Philosopher(cown_ptr<Fork> left, cown_ptr<Fork> right, int hunger)
-    : left(left), right(right), hunger(hunger)
+    Philosopher(cown_ptr<Fork> left, cown_ptr<Fork> right, int hunger, boc::profile::Tag left_tag, boc::profile::Tag right_tag)
+    : left(left), right(right), hunger(hunger), left_tag(left_tag), right_tag(right_tag)
     {}
 
     static void eat(std::unique_ptr<Philosopher> phil)
     {
       if (phil->hunger > 0)
       {
-        when(phil->left, phil->right) << [phil = std::move(phil)](acquired_cown<Fork> left, acquired_cown<Fork> right) mutable {
+        boc::profile::Tag tags[] = {phil->left_tag, phil->right_tag};
+        when(phil->left, phil->right) << boc::profile::track("eat", tags, [phil = std::move(phil)](acquired_cown<Fork> left, acquired_cown<Fork> right) mutable {
           left->use();
           right->use();
           phil->hunger--;
           eat(std::move(phil));
-        };
+        });
       }
     }
   };
@@ -53,14 +57,22 @@ namespace DiningPhils {
 
     cown_ptr<Fork> first = make_cown<Fork>(hunger);
     cown_ptr<Fork> fork = first;
-    for (int i = 0; i < 4; ++i)
-      Philosopher::eat(std::make_unique<Philosopher>(std::exchange(fork, make_cown<Fork>(hunger)), fork, hunger));
-    Philosopher::eat(std::make_unique<Philosopher>(fork, first, hunger));
+    boc::profile::Tag first_tag = boc::profile::tag("fork 0");
+    boc::profile::Tag tag = first_tag;
+    for (int i = 0; i < 4; ++i) {
+      boc::profile::Tag left_tag = std::exchange(tag, boc::profile::tag("fork " + std::to_string(i + 1)));
+      Philosopher::eat(std::make_unique<Philosopher>(std::exchange(fork, make_cown<Fork>(hunger)), fork, hunger, left_tag, tag));
+    }
+    Philosopher::eat(std::make_unique<Philosopher>(fork, first, hunger, tag, first_tag));
   }
 }
 
 int main(int argc, char** argv)
 {
   SystematicTestHarness harness(argc, argv);
+  boc::profile::configure(harness.opt);
+  boc::trace::configure(harness.opt);
   harness.run(DiningPhils::run);
+  boc::trace::dump();
+  boc::profile::report();
 }
\ No newline at end of file
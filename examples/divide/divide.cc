@@ -0,0 +1,288 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <memory>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/dc.h>
+#include <boc/workload.h>
+#ifdef BOC_HAVE_STD_PAR
+#include <execution>
+#endif
+
+using namespace verona::cpp;
+
+namespace Divide {
+  /*
+   * CPU bound batch jobs on the boc::dc skeleton, each compared with a sequential version
+   * and, when the standard library has a parallel backend (BOC_HAVE_STD_PAR, set when
+   * CMake finds TBB), std::execution::par:
+   * - Sort, a merge sort, the base cases std::sort their range and each combine merges the
+   *   two sorted halves into the other of two buffers.  Every base case is at the same depth
+   *   so each level of merges reads one buffer and writes the other, and the result is just
+   *   the buffer and range the sorted run is in.
+   * - MatMul, C = A * B for square matrices, split along the rows or columns of C until a
+   *   block has at most block * block elements, each base case computes its block of C in
+   *   place and combine has nothing to do.
+   */
+
+  size_t cutoff = 1 << 16;
+  size_t block = 64;
+
+  namespace Sort {
+    struct Problem {
+      size_t lo;
+      size_t hi;
+      unsigned depth;
+    };
+
+    struct Run {
+      int* base = nullptr;
+      size_t lo = 0;
+      size_t hi = 0;
+    };
+
+    struct Ops {
+      using Problem = Sort::Problem;
+      using Result = Run;
+
+      int* data;
+      int* scratch;
+      unsigned depth;
+
+      bool is_base(const Problem& p) const { return p.depth == 0; }
+
+      // the runs at depth d are in data if d has the parity of the root, so the root is in data
+      int* buffer(unsigned d) const { return (depth - d) % 2 == 0 ? data : scratch; }
+
+      Run base(Problem p) const {
+        int* out = buffer(0);
+        if (out != data)
+          std::copy(data + p.lo, data + p.hi, out + p.lo);
+        std::sort(out + p.lo, out + p.hi);
+        return Run{out, p.lo, p.hi};
+      }
+
+      std::pair<Problem, Problem> split(Problem p) const {
+        size_t mid = p.lo + (p.hi - p.lo) / 2;
+        return {Problem{p.lo, mid, p.depth - 1}, Problem{mid, p.hi, p.depth - 1}};
+      }
+
+      Run combine(Run&& l, Run&& r) const {
+        int* out = l.base == data ? scratch : data;
+        std::merge(l.base + l.lo, l.base + l.hi, r.base + r.lo, r.base + r.hi, out + l.lo);
+        return Run{out, l.lo, r.hi};
+      }
+    };
+
+    std::vector<int> data;
+    std::vector<int> scratch;
+
+    void generate(size_t n) {
+      boc::Rng rng(42);
+      data.resize(n);
+      for (auto& x : data)
+        x = int(rng.next());
+    }
+
+    void parallel() {
+      scratch.resize(data.size());
+      unsigned depth = 0;
+      while ((data.size() >> depth) > cutoff)
+        depth++;
+      Ops ops{data.data(), scratch.data(), depth};
+      verona::rt::schedule_lambda([ops]() {
+        when(boc::dc::solve(ops, Problem{0, data.size(), ops.depth})) << [](acquired_cown<Run> run) {
+          check(run->base == data.data() && run->lo == 0 && run->hi == data.size());
+        };
+      });
+    }
+
+    void sequential() {
+      verona::rt::schedule_lambda([]() { std::sort(data.begin(), data.end()); });
+    }
+
+#ifdef BOC_HAVE_STD_PAR
+    void par() {
+      verona::rt::schedule_lambda([]() { std::sort(std::execution::par, data.begin(), data.end()); });
+    }
+#endif
+
+    void verify() { check(std::is_sorted(data.begin(), data.end())); }
+  }
+
+  namespace MatMul {
+    struct Problem {
+      size_t i0, i1;
+      size_t j0, j1;
+    };
+
+    struct Unit {};
+
+    size_t n;
+    std::vector<double> a;
+    std::vector<double> b;
+    std::vector<double> c;
+
+    // C[i0:i1, j0:j1] = A[i0:i1, :] * B[:, j0:j1], tiled over k so a tile of B stays in cache
+    void kernel(size_t i0, size_t i1, size_t j0, size_t j1) {
+      for (size_t i = i0; i < i1; ++i)
+        std::fill(&c[i * n + j0], &c[i * n + j1], 0.0);
+      for (size_t k0 = 0; k0 < n; k0 += block) {
+        size_t k1 = std::min(n, k0 + block);
+        for (size_t i = i0; i < i1; ++i) {
+          double* ci = &c[i * n];
+          for (size_t k = k0; k < k1; ++k) {
+            double aik = a[i * n + k];
+            const double* bk = &b[k * n];
+            for (size_t j = j0; j < j1; ++j)
+              ci[j] += aik * bk[j];
+          }
+        }
+      }
+    }
+
+    struct Ops {
+      using Problem = MatMul::Problem;
+      using Result = Unit;
+
+      bool is_base(const Problem& p) const { return (p.i1 - p.i0) * (p.j1 - p.j0) <= block * block; }
+
+      Unit base(Problem p) const {
+        kernel(p.i0, p.i1, p.j0, p.j1);
+        return Unit{};
+      }
+
+      std::pair<Problem, Problem> split(Problem p) const {
+        if (p.i1 - p.i0 >= p.j1 - p.j0) {
+          size_t mid = p.i0 + (p.i1 - p.i0) / 2;
+          return {Problem{p.i0, mid, p.j0, p.j1}, Problem{mid, p.i1, p.j0, p.j1}};
+        }
+        size_t mid = p.j0 + (p.j1 - p.j0) / 2;
+        return {Problem{p.i0, p.i1, p.j0, mid}, Problem{p.i0, p.i1, mid, p.j1}};
+      }
+
+      Unit combine(Unit&&, Unit&&) const { return Unit{}; }
+    };
+
+    void generate(size_t size) {
+      n = size;
+      boc::Rng rng(42);
+      a.resize(n * n);
+      b.resize(n * n);
+      c.assign(n * n, 0.0);
+      // small integers so every sum is exact whatever order it is computed in
+      for (auto& x : a)
+        x = double(rng.below(8));
+      for (auto& x : b)
+        x = double(rng.below(8));
+    }
+
+    void parallel() {
+      verona::rt::schedule_lambda([]() {
+        when(boc::dc::solve(Ops{}, Problem{0, n, 0, n})) << [](acquired_cown<Unit>) {};
+      });
+    }
+
+    void sequential() {
+      verona::rt::schedule_lambda([]() { kernel(0, n, 0, n); });
+    }
+
+#ifdef BOC_HAVE_STD_PAR
+    void par() {
+      verona::rt::schedule_lambda([]() {
+        std::vector<size_t> rows;
+        for (size_t i = 0; i < n; i += block)
+          rows.push_back(i);
+        std::for_each(std::execution::par, rows.begin(), rows.end(), [](size_t i) { kernel(i, std::min(n, i + block), 0, n); });
+      });
+    }
+#endif
+
+    void verify() {
+      boc::Rng rng(7);
+      for (size_t s = 0; s < 64; ++s) {
+        size_t i = rng.below(n), j = rng.below(n);
+        double expected = 0;
+        for (size_t k = 0; k < n; ++k)
+          expected += a[i * n + k] * b[k * n + j];
+        check(c[i * n + j] == expected);
+      }
+    }
+  }
+
+  void run() {
+    Sort::generate(1 << 18);
+    Sort::parallel();
+    MatMul::generate(256);
+    MatMul::parallel();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  if (!harness.opt.has("--workload")) {
+    harness.run(Divide::run);
+    Divide::Sort::verify();
+    Divide::MatMul::verify();
+    return 0;
+  }
+
+  std::string workload = harness.opt.is<const char*>("--workload", "sort");
+  std::string impl = harness.opt.is<const char*>("--impl", "boc");
+  Divide::cutoff = std::max<size_t>(harness.opt.is<size_t>("--cutoff", Divide::cutoff), 1);
+  Divide::block = std::max<size_t>(harness.opt.is<size_t>("--block", Divide::block), 1);
+
+#ifndef BOC_HAVE_STD_PAR
+  // a marker line rather than an error, so a benchmark matrix can list par either way
+  if (impl == "par") {
+    std::cout << "skipped,workload=" << workload << ",impl=par,reason=built without a parallel standard library" << std::endl;
+    return 0;
+  }
+#endif
+
+  void (*f)() = nullptr;
+  size_t n;
+  double work;
+  if (workload == "sort") {
+    n = harness.opt.is<size_t>("--n", 10000000);
+    Divide::Sort::generate(n);
+    f = impl == "boc" ? Divide::Sort::parallel : impl == "seq" ? Divide::Sort::sequential : nullptr;
+#ifdef BOC_HAVE_STD_PAR
+    if (impl == "par")
+      f = Divide::Sort::par;
+#endif
+    work = double(n);
+  } else if (workload == "matmul") {
+    n = harness.opt.is<size_t>("--n", 1024);
+    Divide::MatMul::generate(n);
+    f = impl == "boc" ? Divide::MatMul::parallel : impl == "seq" ? Divide::MatMul::sequential : nullptr;
+#ifdef BOC_HAVE_STD_PAR
+    if (impl == "par")
+      f = Divide::MatMul::par;
+#endif
+    work = 2.0 * double(n) * double(n) * double(n);
+  } else {
+    std::cerr << "unknown workload " << workload << ", one of sort matmul" << std::endl;
+    return 1;
+  }
+  if (f == nullptr) {
+    std::cerr << "unknown or unavailable implementation " << impl << ", one of boc seq par" << std::endl;
+    return 1;
+  }
+
+  double t = boc::timed_run(harness, f);
+  if (workload == "sort")
+    Divide::Sort::verify();
+  else
+    Divide::MatMul::verify();
+
+  boc::Report r;
+  r("workload", workload)("impl", impl)("n", n)("seconds", t);
+  if (workload == "sort")
+    r("elements_per_second", work / t);
+  else
+    r("flops_per_second", work / t);
+}
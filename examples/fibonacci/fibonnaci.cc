@@ -1,8 +1,12 @@
 // Copyright Microsoft and Project Verona Contributors.
 // SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <debug/harness.h>
 #include <cpp/when.h>
+#include <boc/admission.h>
+#include <boc/bench.h>
 
 using namespace verona::cpp;
 
@@ -12,33 +16,93 @@ namespace Fib {
    *   - sequential generates values for n < 4 fib numbers sequentially
    *   - parallel recursively spawns behaviours to solves sub-problems and creates a behaviour
    *     that joins the results once they are ready
+   *   - bounded is parallel under admission control, once the bound on outstanding behaviours
+   *     is reached the spawner solves the remaining sub-problems inline instead of creating
+   *     cowns and behaviours for them, which bounds the memory used for large n
+   *   - with --per_source the bound is per spawning thread (boc::Admissions) rather than
+   *     shared by every thread
+   * The values are 64 bit, fib(93) is the largest that fits.
    */
 
-  int sequential(int n)
+  uint64_t sequential(int n)
   {
     return n <= 1 ? n : Fib::sequential(n - 1) + Fib::sequential(n - 2);
   }
 
-  cown_ptr<int> parallel(int n)
+  cown_ptr<uint64_t> parallel(int n)
   {
     if (n <= 4) {
-      cown_ptr<int> result = make_cown<int>(int{0});
-      when (result) << [n](acquired_cown<int> result) { *result = Fib::sequential(n); };
+      cown_ptr<uint64_t> result = make_cown<uint64_t>(uint64_t{0});
+      when (result) << [n](acquired_cown<uint64_t> result) { *result = Fib::sequential(n); };
       return result;
     } else {
-      cown_ptr<int> f1 = Fib::parallel(n - 1);
-      cown_ptr<int> f2 = Fib::parallel(n - 2);
-      when(f1, f2) << [](acquired_cown<int> f1, acquired_cown<int> f2) { *f1 += * f2; };
+      cown_ptr<uint64_t> f1 = Fib::parallel(n - 1);
+      cown_ptr<uint64_t> f2 = Fib::parallel(n - 2);
+      when(f1, f2) << [](acquired_cown<uint64_t> f1, acquired_cown<uint64_t> f2) { *f1 += * f2; };
       return f1;
     }
   }
 
+  std::unique_ptr<boc::Admission> admission;
+  std::unique_ptr<boc::Admissions> sources;
+
+  // the Admission the calling thread spawns through
+  boc::Admission& source()
+  {
+    return sources ? sources->local() : *admission;
+  }
+
+  cown_ptr<uint64_t> bounded(int n)
+  {
+    boc::Admission& admission = Fib::source();
+    if (n <= 4 || !admission.try_admit()) {
+      return make_cown<uint64_t>(Fib::sequential(n));
+    } else {
+      cown_ptr<uint64_t> f1 = Fib::bounded(n - 1);
+      cown_ptr<uint64_t> f2 = Fib::bounded(n - 2);
+      when(f1, f2) << admission.track([](acquired_cown<uint64_t> f1, acquired_cown<uint64_t> f2) { *f1 += * f2; });
+      return f1;
+    }
+  }
+
+  uint64_t iterative(int n)
+  {
+    uint64_t a = 0, b = 1;
+    for (int i = 0; i < n; ++i)
+      b = std::exchange(a, b) + b;
+    return a;
+  }
+
+  /*
+   * Benchmark of a single large fibonacci number, a bound of 0 uses parallel
+   */
+  void bench(int n, size_t bound, bool per_source)
+  {
+    if (bound != 0 && per_source)
+      sources = std::make_unique<boc::Admissions>(bound);
+    else if (bound != 0)
+      admission = std::make_unique<boc::Admission>(bound);
+
+    verona::rt::schedule_lambda([n, bound](){
+      cown_ptr<uint64_t> result = bound == 0 ? Fib::parallel(n) : Fib::bounded(n);
+      when(result) << [n](acquired_cown<uint64_t> result) { check(*result == Fib::iterative(n)); };
+    });
+  }
+
+  size_t max_outstanding()
+  {
+    return sources ? sources->max_outstanding() : admission ? admission->max_outstanding() : 0;
+  }
+
   void run()
   {
+    admission = std::make_unique<boc::Admission>(16);
+
     verona::rt::schedule_lambda([](){
-      when(Fib::parallel(1)) << [](acquired_cown<int> result) { check(*result == 1); };
-      when(Fib::parallel(10)) << [](acquired_cown<int> result) { check(*result == 55); };
-      when(Fib::parallel(15)) << [](acquired_cown<int> result) { check(*result == 610); };
+      when(Fib::parallel(1)) << [](acquired_cown<uint64_t> result) { check(*result == 1); };
+      when(Fib::parallel(10)) << [](acquired_cown<uint64_t> result) { check(*result == 55); };
+      when(Fib::parallel(15)) << [](acquired_cown<uint64_t> result) { check(*result == 610); };
+      when(Fib::bounded(15)) << [](acquired_cown<uint64_t> result) { check(*result == 610); };
     });
   }
 }
@@ -46,5 +110,14 @@ namespace Fib {
 int main(int argc, char** argv)
 {
   SystematicTestHarness harness(argc, argv);
-  harness.run(Fib::run);
+  if (harness.opt.has("--n")) {
+    int n = std::min(harness.opt.is<int>("--n", 30), 93);
+    size_t bound = harness.opt.is<size_t>("--bound", 0);
+    bool per_source = harness.opt.has("--per_source");
+    double t = boc::timed_run(harness, Fib::bench, n, bound, per_source);
+    boc::Report()("n", n)("bound", bound)("per_source", per_source)("seconds", t)("peak_rss_kb", boc::peak_rss_kb())
+      ("max_outstanding", Fib::max_outstanding());
+  } else {
+    harness.run(Fib::run);
+  }
 }
@@ -0,0 +1,247 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace HashJoin {
+  /*
+   * An equi-join of a build relation R with a probe relation S on their keys, partitioned
+   * over cowns by the hash of the key:
+   * - the rows of R are split into chunks, a behaviour per chunk scatters its rows by
+   *   partition and appends them to each partition cown, once every chunk is in the
+   *   partitions a behaviour per partition builds its hash table, all in parallel
+   * - the rows of S are also split into chunks, a behaviour per chunk scatters its rows by
+   *   partition and spawns a probe batch per partition that acquires the partition with
+   *   read(), so any number of batches probe a partition concurrently
+   * - with radix_bits > 0 each partition is split again into 2^radix_bits sub-partitions
+   *   with a table each, by the next bits of the hash, when it is built and when a batch
+   *   probes it, so that the table being probed stays in cache (a two pass radix join)
+   *
+   * R has the keys 0 to build_rows - 1 once each, and S keys drawn uniformly from them, so
+   * every row of S matches exactly one row of R.  The rows of S are generated by the chunk
+   * behaviours rather than stored, so S can be much larger than memory.
+   */
+
+  struct Row {
+    uint64_t key;
+    uint64_t payload;
+  };
+
+  constexpr uint64_t empty = ~uint64_t(0);
+
+  uint64_t hash(uint64_t key) { return key * 0x9e3779b97f4a7c15ull; }
+
+  size_t build_rows = 1 << 20;
+  size_t probe_rows = 1 << 23;
+  size_t chunk_rows = 1 << 16;
+  unsigned partition_bits = 6;
+  unsigned radix_bits = 0;
+
+  size_t partition(uint64_t h) { return partition_bits ? size_t(h >> (64 - partition_bits)) : 0; }
+
+  size_t sub_partition(uint64_t h) {
+    return radix_bits ? size_t(h >> (64 - partition_bits - radix_bits)) & ((size_t(1) << radix_bits) - 1) : 0;
+  }
+
+  // linear probing over the low bits of the hash, which partitioning has not used
+  class Table {
+    std::vector<Row> slots;
+    uint64_t mask = 0;
+
+  public:
+    void build(const std::vector<Row>& rows) {
+      size_t size = 2;
+      while (size < 2 * rows.size())
+        size *= 2;
+      mask = size - 1;
+      slots.assign(size, Row{empty, 0});
+      for (auto& r : rows) {
+        uint64_t i = hash(r.key) & mask;
+        while (slots[i].key != empty)
+          i = (i + 1) & mask;
+        slots[i] = r;
+      }
+    }
+
+    template<typename F>
+    void probe(uint64_t key, F f) const {
+      for (uint64_t i = hash(key) & mask; slots[i].key != empty; i = (i + 1) & mask)
+        if (slots[i].key == key)
+          f(slots[i].payload);
+    }
+  };
+
+  struct Partition {
+    std::vector<Row> rows;
+    std::vector<Table> tables;
+  };
+
+  // groups rows by sub_partition, returning where each group starts
+  std::vector<size_t> scatter(std::vector<Row>& rows) {
+    size_t n = size_t(1) << radix_bits;
+    std::vector<size_t> start(n + 1, 0);
+    for (auto& r : rows)
+      start[sub_partition(hash(r.key)) + 1]++;
+    for (size_t i = 0; i < n; ++i)
+      start[i + 1] += start[i];
+    std::vector<Row> sorted(rows.size());
+    std::vector<size_t> next(start.begin(), start.end() - 1);
+    for (auto& r : rows)
+      sorted[next[sub_partition(hash(r.key))]++] = r;
+    rows.swap(sorted);
+    return start;
+  }
+
+  using Clock = std::chrono::steady_clock;
+
+  std::vector<Row> build_relation;
+  std::vector<cown_ptr<Partition>> partitions;
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> matches{0};
+  std::atomic<uint64_t> checksum{0};
+  std::atomic<uint64_t> expected{0};
+  Clock::time_point start;
+  double build_seconds = 0;
+  double probe_seconds = 0;
+
+  uint64_t payload(uint64_t key) { return key ^ 0x5555555555555555ull; }
+
+  void generate() {
+    build_relation.resize(build_rows);
+    for (size_t i = 0; i < build_rows; ++i)
+      build_relation[i] = Row{i, payload(i)};
+    boc::Rng rng(42);
+    for (size_t i = build_rows; i > 1; --i)
+      std::swap(build_relation[i - 1], build_relation[rng.below(i)]);
+  }
+
+  // calls f once every row of rows has been grouped by partition, f(partition, rows)
+  template<typename F>
+  void by_partition(std::vector<Row>& rows, F f) {
+    std::vector<std::vector<Row>> parts(size_t(1) << partition_bits);
+    for (auto& r : rows)
+      parts[partition(hash(r.key))].push_back(r);
+    for (size_t p = 0; p < parts.size(); ++p)
+      if (!parts[p].empty())
+        f(p, std::move(parts[p]));
+  }
+
+  void finish() {
+    probe_seconds = std::chrono::duration<double>(Clock::now() - start).count() - build_seconds;
+    check(matches == probe_rows);
+    check(checksum == expected);
+    // the partitions must not outlive the run
+    partitions.clear();
+  }
+
+  void probe(size_t chunks) {
+    if (chunks == 0)
+      return finish();
+    pending = chunks;
+    for (size_t c = 0; c < chunks; ++c) {
+      when() << [c]() {
+        size_t from = c * chunk_rows, to = std::min(probe_rows, from + chunk_rows);
+        boc::Rng rng(c + 1);
+        std::vector<Row> rows;
+        uint64_t sum = 0;
+        for (size_t i = from; i < to; ++i) {
+          uint64_t key = rng.below(build_rows);
+          rows.push_back(Row{key, i});
+          sum += payload(key);
+        }
+        expected += sum;
+
+        by_partition(rows, [](size_t p, std::vector<Row> batch) {
+          pending++;
+          when(read(partitions[p])) << [batch = std::move(batch)](acquired_cown<const Partition> part) mutable {
+            auto start = scatter(batch);
+            size_t found = 0;
+            uint64_t sum = 0;
+            for (size_t s = 0; s + 1 < start.size(); ++s)
+              for (size_t i = start[s]; i < start[s + 1]; ++i)
+                part->tables[s].probe(batch[i].key, [&](uint64_t payload) {
+                  found++;
+                  sum += payload;
+                });
+            matches += found;
+            checksum += sum;
+            if (--pending == 0)
+              finish();
+          };
+        });
+
+        if (--pending == 0)
+          finish();
+      };
+    }
+  }
+
+  void build() {
+    pending = partitions.size();
+    for (auto& p : partitions) {
+      when(p) << [](acquired_cown<Partition> part) {
+        auto start = scatter(part->rows);
+        part->tables.resize(start.size() - 1);
+        for (size_t s = 0; s + 1 < start.size(); ++s)
+          part->tables[s].build(std::vector<Row>(part->rows.begin() + start[s], part->rows.begin() + start[s + 1]));
+        part->rows = {};
+
+        if (--pending == 0) {
+          build_seconds = std::chrono::duration<double>(Clock::now() - HashJoin::start).count();
+          probe((probe_rows + chunk_rows - 1) / chunk_rows);
+        }
+      };
+    }
+  }
+
+  void run() {
+    start = Clock::now();
+    matches = 0;
+    checksum = 0;
+    expected = 0;
+    partitions.clear();
+    for (size_t p = 0; p < (size_t(1) << partition_bits); ++p)
+      partitions.push_back(make_cown<Partition>());
+
+    size_t chunks = (build_rows + chunk_rows - 1) / chunk_rows;
+    pending = chunks;
+    for (size_t c = 0; c < chunks; ++c) {
+      when() << [c]() {
+        size_t from = c * chunk_rows, to = std::min(build_rows, from + chunk_rows);
+        std::vector<Row> rows(build_relation.begin() + from, build_relation.begin() + to);
+        by_partition(rows, [](size_t p, std::vector<Row> part) {
+          when(partitions[p]) << [part = std::move(part)](acquired_cown<Partition> partition) {
+            partition->rows.insert(partition->rows.end(), part.begin(), part.end());
+          };
+        });
+        // every chunk's appends are spawned before the builds, so run before them
+        if (--pending == 0)
+          build();
+      };
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  HashJoin::build_rows = std::max<size_t>(harness.opt.is<size_t>("--build_rows", HashJoin::build_rows), 1);
+  HashJoin::probe_rows = harness.opt.is<size_t>("--probe_rows", HashJoin::probe_rows);
+  HashJoin::chunk_rows = std::max<size_t>(harness.opt.is<size_t>("--chunk_rows", HashJoin::chunk_rows), 1);
+  HashJoin::partition_bits = std::min<unsigned>(harness.opt.is<size_t>("--partition_bits", HashJoin::partition_bits), 16);
+  HashJoin::radix_bits = std::min<unsigned>(harness.opt.is<size_t>("--radix_bits", HashJoin::radix_bits), 16);
+  HashJoin::generate();
+
+  double t = boc::timed_run(harness, HashJoin::run);
+  boc::Report()("variant", HashJoin::radix_bits ? "radix" : "hash")("partitions", size_t(1) << HashJoin::partition_bits)
+    ("sub_partitions", size_t(1) << HashJoin::radix_bits)("build_rows", HashJoin::build_rows)("probe_rows", HashJoin::probe_rows)
+    ("build_seconds", HashJoin::build_seconds)("probe_seconds", HashJoin::probe_seconds)("seconds", t)
+    ("rows_per_second", (HashJoin::build_rows + HashJoin::probe_rows) / t);
+}
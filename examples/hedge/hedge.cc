@@ -0,0 +1,127 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/promise.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace Hedge {
+  /*
+   * Hedged requests: every request is sent to replicas servers and answered by the first
+   * replica to finish, through boc::any over the replicas' promises.
+   *
+   * - a server is a cown, so a replica waits for the work queued on its server before it
+   *   runs, as a request to a busy machine would
+   * - a replica computes for fast_usec, or with probability tail for slow_usec, the cost of
+   *   the losing branch when another replica is fast
+   * - clients each keep one request outstanding until requests have been answered
+   *
+   * With --cancel the replicas use the promise's token: a replica skips its work if the
+   * request has been answered by the time it runs and stops between steps of step_usec once
+   * it has.  Without it every replica runs to the end, its result dropped.  work_ms is the
+   * computation the servers did in total.
+   */
+
+  struct Server {};
+
+  size_t num_servers = 16;
+  size_t num_clients = 8;
+  size_t num_requests = 20000;
+  size_t replicas = 2;
+  size_t fast_usec = 20;
+  size_t slow_usec = 1000;
+  double tail = 0.1;
+  size_t step_usec = 10;
+  bool cancel = false;
+
+  std::vector<cown_ptr<Server>> servers;
+  std::atomic<size_t> issued{0};
+  std::atomic<size_t> answered{0};
+  std::atomic<uint64_t> work_usec{0};
+  boc::Latencies latencies;
+
+  using Clock = std::chrono::steady_clock;
+
+  void replica(boc::promise<size_t> p, size_t server, size_t cost) {
+    when(servers[server]) << [p, cost](acquired_cown<Server>) mutable {
+      if (cancel && p.token().skip())
+        return;
+      for (size_t done = 0; done < cost; done += step_usec) {
+        if (cancel && done > 0 && p.token().abort())
+          return;
+        size_t step = std::min(step_usec, cost - done);
+        busy_loop(step);
+        work_usec += step;
+      }
+      p.fulfill(cost);
+    };
+  }
+
+  void request(size_t client, boc::Rng rng) {
+    if (issued++ >= num_requests)
+      return;
+    auto start = Clock::now();
+
+    std::vector<boc::promise<size_t>> ps(replicas);
+    size_t first = rng.below(num_servers);
+    for (size_t i = 0; i < replicas; ++i) {
+      size_t cost = rng.uniform() < tail ? slow_usec : fast_usec;
+      replica(ps[i], (first + i) % num_servers, cost);
+    }
+
+    boc::any(ps).then([client, rng, start](const size_t&) {
+      latencies.record(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+      if (++answered == num_requests) {
+        // cowns must not outlive the run
+        servers.clear();
+        return;
+      }
+      request(client, rng);
+    });
+  }
+
+  void run() {
+    servers.clear();
+    for (size_t i = 0; i < num_servers; ++i)
+      servers.push_back(make_cown<Server>());
+    if (num_requests == 0) {
+      servers.clear();
+      return;
+    }
+    for (size_t c = 0; c < num_clients; ++c)
+      request(c, boc::Rng(c + 1));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  Hedge::num_servers = std::max<size_t>(harness.opt.is<size_t>("--servers", Hedge::num_servers), 1);
+  Hedge::num_clients = std::max<size_t>(harness.opt.is<size_t>("--clients", Hedge::num_clients), 1);
+  Hedge::num_requests = harness.opt.is<size_t>("--requests", Hedge::num_requests);
+  Hedge::replicas = std::clamp<size_t>(harness.opt.is<size_t>("--replicas", Hedge::replicas), 1, Hedge::num_servers);
+  Hedge::fast_usec = harness.opt.is<size_t>("--fast_usec", Hedge::fast_usec);
+  Hedge::slow_usec = harness.opt.is<size_t>("--slow_usec", Hedge::slow_usec);
+  Hedge::tail = std::atof(harness.opt.is<const char*>("--tail", "0.1"));
+  Hedge::step_usec = std::max<size_t>(harness.opt.is<size_t>("--step_usec", Hedge::step_usec), 1);
+  Hedge::cancel = harness.opt.has("--cancel");
+
+  double t = boc::timed_run(harness, Hedge::run);
+  auto sorted = Hedge::latencies.sorted();
+  auto& saved = boc::Cancellation::counters();
+  size_t losers = Hedge::num_requests * (Hedge::replicas - 1);
+  boc::Report()("cancel", Hedge::cancel)("replicas", Hedge::replicas)("slow_usec", Hedge::slow_usec)("requests", Hedge::num_requests)
+    ("seconds", t)("requests_per_second", Hedge::answered / t)("p50_us", boc::Latencies::percentile(sorted, 0.5))
+    ("p99_us", boc::Latencies::percentile(sorted, 0.99))("work_ms", Hedge::work_usec / 1000.0)
+    ("saved_rate", losers ? double(saved.skipped + saved.aborted) / double(losers) : 0.0);
+
+  check(Hedge::answered == Hedge::num_requests);
+}
@@ -1,8 +1,12 @@
 // Copyright Microsoft and Project Verona Contributors.
 // SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <debug/harness.h>
 #include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/guard.h>
 
 #include <optional>
 #include <iostream>
@@ -13,6 +17,16 @@ using namespace std;
 
 namespace Joins {
 
+  /*
+   * With --guarded a pattern is a boc::whenever over its channels, woken by the writes to them,
+   * instead of an observer notified of every write that then acquires all the channels and
+   * bails out if one of them is empty.  The bail outs are the wasted behaviours.
+   */
+  bool guarded = false;
+  // matching behaviours spawned by the observers, and those that found a channel empty
+  std::atomic<size_t> behaviours{0};
+  std::atomic<size_t> wasted{0};
+
   struct Observer {
     virtual void notify() = 0;
 
@@ -20,7 +34,7 @@ namespace Joins {
   };
 
   template<typename T>
-  struct Channel {
+  struct Channel : public boc::Guarded {
     /* Channel has:
         - a queue of data to be read
         - a list of observers to notify whenever there is data
@@ -37,6 +51,10 @@ namespace Joins {
       before an observer can when on the channel and observe the state
     */
     static void notify_all(acquired_cown<Channel<T>>& channel) {
+      if (guarded) {
+        channel->signal();
+        return;
+      }
       for (auto& observer : channel->observers) {
         when(observer) << [c=channel.cown()] (acquired_cown<unique_ptr<Observer>> observer) {
           assert(c);
@@ -60,7 +78,8 @@ namespace Joins {
       if (channel->data.size() > 0) {
         unique_ptr<T> front = move(channel->data.front());
         channel->data.pop();
-        if (channel->data.size() > 0)
+        // a guarded pattern reads for as long as it matches, a read makes no other match
+        if (!guarded && channel->data.size() > 0)
           Channel<T>::notify_all(channel);
         return front;
       }
@@ -178,9 +197,12 @@ namespace Joins {
 
         /* Otherwise, attempt to read a value from all channels and call the pattern callback */
         apply([f=f](auto &&... args) mutable {
+          behaviours++;
           when(args...) << [f=forward<F>(f)](acquired_cown<Channel<Args>>... channels) mutable {
-            if ((!channels->has_data() || ...))
+            if ((!channels->has_data() || ...)) {
+              wasted++;
               return;
+            }
             f(read(channels)...);
           };
         }, move(cs));
@@ -188,6 +210,17 @@ namespace Joins {
     };
 
     void Do(F run) {
+      if (guarded) {
+        apply([run=forward<F>(run)](auto &&...args) mutable {
+          boc::whenever([](acquired_cown<Channel<Args>>&... channels) {
+            return (channels->has_data() && ...);
+          }, args...) << [run=move(run)](acquired_cown<Channel<Args>>&... channels) mutable {
+            run(read(channels)...);
+          };
+        }, move(channels));
+        return;
+      }
+
       auto pattern = make_cown<unique_ptr<Observer>>(
         apply([run=forward<F>(run)](auto &&...args) mutable {
           return make_unique<P>(forward<F>(run), args...);
@@ -259,10 +292,61 @@ namespace Joins {
     write(put_string, make_unique<DataMessage<string>>(make_unique<string>("a string ")));
 
   }
+
+  /*
+    With --messages the patterns are driven by writers behaviours, each writing its share of
+    messages values on put and on put_string and twice as many replies on get, which both
+    patterns compete for.
+  */
+  size_t num_messages = 0;
+  size_t writers = 4;
+  std::atomic<size_t> replies{0};
+
+  void workload() {
+    auto put = make_cown<Channel<DataMessage<int>>>();
+    auto put_string = make_cown<Channel<DataMessage<string>>>();
+    auto get = make_cown<Channel<ReplyMessage<int>>>();
+
+    Join::When(put).And(get).Do([](unique_ptr<DataMessage<int>> put, unique_ptr<ReplyMessage<int>> get) {
+      (*(get->reply))(move(*(put->data)));
+    });
+
+    Join::When(put_string).And(get).Do([](unique_ptr<DataMessage<string>> put_string, unique_ptr<ReplyMessage<int>> get) {
+      (*(get->reply))(make_unique<int>((*(put_string->data))->size()));
+    });
+
+    for (size_t w = 0; w < writers; ++w) {
+      size_t count = num_messages / writers + (w < num_messages % writers);
+      verona::rt::schedule_lambda([put, put_string, get, count]() {
+        for (size_t i = 0; i < count; ++i) {
+          write(put, make_unique<DataMessage<int>>(make_unique<int>(int(i))));
+          write(put_string, make_unique<DataMessage<string>>(make_unique<string>("a string ")));
+          for (size_t r = 0; r < 2; ++r)
+            write(get, make_unique<ReplyMessage<int>>([](unique_ptr<int>) { replies++; }));
+        }
+      });
+    }
+  }
 }
 
 int main(int argc, char** argv)
 {
   SystematicTestHarness harness(argc, argv);
-  harness.run(Joins::run);
-}
\ No newline at end of file
+  Joins::guarded = harness.opt.has("--guarded");
+  Joins::num_messages = harness.opt.is<size_t>("--messages", Joins::num_messages);
+  Joins::writers = std::max<size_t>(harness.opt.is<size_t>("--writers", Joins::writers), 1);
+
+  if (Joins::num_messages == 0) {
+    harness.run(Joins::run);
+    return 0;
+  }
+
+  double t = boc::timed_run(harness, Joins::workload);
+  auto& guards = boc::Guarded::counters();
+  size_t behaviours = Joins::guarded ? guards.evaluations.load() : Joins::behaviours.load();
+  size_t wasted = Joins::guarded ? guards.wasted.load() : Joins::wasted.load();
+  boc::Report()("guarded", Joins::guarded)("messages", Joins::num_messages)("seconds", t)
+    ("replies_per_second", Joins::replies / t)("spawned", behaviours)("wasted", wasted);
+
+  check(Joins::replies == 2 * Joins::num_messages);
+}
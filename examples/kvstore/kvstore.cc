@@ -0,0 +1,379 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace KV {
+  /*
+   * A key-value store whose shards are cowns:
+   * - a key belongs to one shard, each shard is a cown holding a hash map
+   * - get acquires the key's shard with read(), so gets on a shard run concurrently with
+   *   each other, put, update and remove acquire it for writing
+   * - multi_get and multi_put are atomic over any set of keys, they acquire the distinct
+   *   shards of the keys in one when over a cown_array
+   * - apply runs a batch of operations, grouped by shard with one behaviour per group that
+   *   reads the shard if the group only has gets, trading latency for fewer behaviours
+   *
+   * Operations run in the order they are spawned on each shard, so a get spawned after a put
+   * of the same key from the same behaviour sees the put.
+   */
+
+  using Key = uint64_t;
+  using Value = std::string;
+
+  struct Shard {
+    std::unordered_map<Key, Value> map;
+  };
+
+  class Store {
+    std::vector<cown_ptr<Shard>> shards;
+
+    // the distinct shards of keys in order, and their cowns
+    std::shared_ptr<std::vector<cown_ptr<Shard>>> shards_of(const std::vector<Key>& keys, std::vector<size_t>& ids) const {
+      for (auto k : keys)
+        ids.push_back(shard(k));
+      std::sort(ids.begin(), ids.end());
+      ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+      auto cowns = std::make_shared<std::vector<cown_ptr<Shard>>>();
+      for (auto id : ids)
+        cowns->push_back(shards[id]);
+      return cowns;
+    }
+
+    static size_t position(const std::vector<size_t>& ids, size_t id) {
+      return size_t(std::lower_bound(ids.begin(), ids.end(), id) - ids.begin());
+    }
+
+  public:
+    struct Op {
+      enum Kind { Get, Put, Remove } kind;
+      Key key;
+      Value value;
+    };
+
+    Store(size_t num_shards, size_t records, const Value& value) {
+      std::vector<Shard> initial(num_shards);
+      for (Key k = 0; k < records; ++k)
+        initial[shard(k, num_shards)].map.emplace(k, value);
+      for (auto& s : initial)
+        shards.push_back(make_cown<Shard>(std::move(s)));
+    }
+
+    static size_t shard(Key key, size_t n) { return size_t((key * 0x9e3779b97f4a7c15ull) >> 32) % n; }
+
+    size_t shard(Key key) const { return shard(key, shards.size()); }
+
+    // f(const Value*), null if the key is absent
+    template<typename F>
+    void get(Key key, F f) {
+      when(read(shards[shard(key)])) << [key, f = std::move(f)](acquired_cown<const Shard> s) mutable {
+        auto it = s->map.find(key);
+        f(it == s->map.end() ? nullptr : &it->second);
+      };
+    }
+
+    template<typename F>
+    void put(Key key, Value value, F f) {
+      when(shards[shard(key)]) << [key, value = std::move(value), f = std::move(f)](acquired_cown<Shard> s) mutable {
+        s->map[key] = std::move(value);
+        f();
+      };
+    }
+
+    // read-modify-write, f(bool) whether the key was present and g applied to its value
+    template<typename G, typename F>
+    void update(Key key, G g, F f) {
+      when(shards[shard(key)]) << [key, g = std::move(g), f = std::move(f)](acquired_cown<Shard> s) mutable {
+        auto it = s->map.find(key);
+        if (it != s->map.end())
+          g(it->second);
+        f(it != s->map.end());
+      };
+    }
+
+    // f(bool), whether the key was present
+    template<typename F>
+    void remove(Key key, F f) {
+      when(shards[shard(key)]) << [key, f = std::move(f)](acquired_cown<Shard> s) mutable {
+        f(s->map.erase(key) > 0);
+      };
+    }
+
+    // f(std::vector<std::optional<Value>>), the values of keys at one point in time
+    template<typename F>
+    void multi_get(std::vector<Key> keys, F f) {
+      std::vector<size_t> ids;
+      auto cowns = shards_of(keys, ids);
+      size_t n = shards.size();
+      when(read(cown_array<Shard>(cowns->data(), cowns->size()))) <<
+        [cowns, n, ids = std::move(ids), keys = std::move(keys), f = std::move(f)](acquired_cown_span<const Shard> span) mutable {
+          std::vector<std::optional<Value>> values;
+          for (auto k : keys) {
+            auto& map = span[position(ids, shard(k, n))]->map;
+            auto it = map.find(k);
+            values.push_back(it == map.end() ? std::nullopt : std::optional<Value>(it->second));
+          }
+          f(std::move(values));
+        };
+    }
+
+    // puts every pair or, until f is called, none of them
+    template<typename F>
+    void multi_put(std::vector<std::pair<Key, Value>> kvs, F f) {
+      std::vector<Key> keys;
+      for (auto& kv : kvs)
+        keys.push_back(kv.first);
+      std::vector<size_t> ids;
+      auto cowns = shards_of(keys, ids);
+      size_t n = shards.size();
+      when(cown_array<Shard>(cowns->data(), cowns->size())) <<
+        [cowns, n, ids = std::move(ids), kvs = std::move(kvs), f = std::move(f)](acquired_cown_span<Shard> span) mutable {
+          for (auto& kv : kvs)
+            span[position(ids, shard(kv.first, n))]->map[kv.first] = std::move(kv.second);
+          f();
+        };
+    }
+
+    // f(size_t), how many gets found their key, once every op has run
+    template<typename F>
+    void apply(std::vector<Op> ops, F f) {
+      std::vector<std::vector<Op>> groups(shards.size());
+      size_t count = 0;
+      for (auto& op : ops) {
+        auto& g = groups[shard(op.key)];
+        count += g.empty();
+        g.push_back(std::move(op));
+      }
+
+      struct Pending {
+        std::atomic<size_t> remaining;
+        std::atomic<size_t> hits{0};
+        F f;
+
+        Pending(size_t remaining, F f): remaining(remaining), f(std::move(f)) {}
+      };
+      auto pending = std::make_shared<Pending>(count, std::move(f));
+      auto finish = [pending](size_t hits) {
+        pending->hits += hits;
+        if (--pending->remaining == 0)
+          pending->f(pending->hits.load());
+      };
+
+      for (size_t i = 0; i < groups.size(); ++i) {
+        auto& g = groups[i];
+        if (g.empty())
+          continue;
+        bool reads = std::all_of(g.begin(), g.end(), [](const Op& op) { return op.kind == Op::Get; });
+        if (reads) {
+          when(read(shards[i])) << [g = std::move(g), finish](acquired_cown<const Shard> s) {
+            size_t hits = 0;
+            for (auto& op : g)
+              hits += s->map.count(op.key);
+            finish(hits);
+          };
+        } else {
+          when(shards[i]) << [g = std::move(g), finish](acquired_cown<Shard> s) mutable {
+            size_t hits = 0;
+            for (auto& op : g) {
+              if (op.kind == Op::Get)
+                hits += s->map.count(op.key);
+              else if (op.kind == Op::Put)
+                s->map[op.key] = std::move(op.value);
+              else
+                s->map.erase(op.key);
+            }
+            finish(hits);
+          };
+        }
+      }
+    }
+  };
+
+  /*
+   * A YCSB style benchmark: the store is loaded with num_records keys, then num_clients
+   * clients each issue their share of num_ops operations, one operation (or batch) at a time,
+   * issuing the next from the completion of the last.  Keys are zipfian and the mix of
+   * operations is one of the YCSB core workloads:
+   * - A, 50% reads and 50% updates
+   * - B, 95% reads and 5% updates
+   * - C, reads only
+   * - F, 50% reads and 50% read-modify-writes
+   * and M, 50% multi_gets and 50% multi_puts of multi_keys keys, for the atomic multi-key
+   * operations YCSB does not have.
+   *
+   * Latency is from issuing an operation to its completion, for a batch every operation in
+   * it has the latency of the batch.
+   */
+
+  struct Mix {
+    double read;
+    double update;
+    double rmw;
+    double multi;
+  };
+
+  size_t num_records = 100000;
+  size_t num_ops = 1 << 20;
+  size_t num_clients = 64;
+  size_t num_shards = 256;
+  size_t batch = 1;
+  size_t multi_keys = 4;
+  size_t value_size = 100;
+  std::string workload = "A";
+
+  using Clock = std::chrono::steady_clock;
+
+  std::unique_ptr<Store> store;
+  std::unique_ptr<boc::Zipf> zipf;
+  std::unique_ptr<boc::Latencies> latencies;
+  std::atomic<size_t> finished{0};
+  Mix mix;
+
+  Mix parse(const std::string& w) {
+    if (w == "A") return Mix{0.5, 0.5, 0, 0};
+    if (w == "B") return Mix{0.95, 0.05, 0, 0};
+    if (w == "C") return Mix{1, 0, 0, 0};
+    if (w == "F") return Mix{0.5, 0, 0.5, 0};
+    if (w == "M") return Mix{0, 0, 0, 0.5};
+    std::cerr << "unknown workload " << w << ", one of A B C F M" << std::endl;
+    exit(1);
+  }
+
+  struct Client {
+    boc::Rng rng;
+    size_t remaining;
+
+    Client(uint64_t seed, size_t remaining): rng(seed), remaining(remaining) {}
+  };
+
+  void issue(std::shared_ptr<Client> c);
+
+  void complete(std::shared_ptr<Client> c, Clock::time_point start, size_t ops) {
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    for (size_t i = 0; i < ops; ++i)
+      latencies->record(us);
+    c->remaining -= std::min(ops, c->remaining);
+    if (c->remaining > 0) {
+      issue(c);
+    } else if (++finished == num_clients) {
+      // every operation has completed, the shards must not outlive the run
+      store.reset();
+    }
+  }
+
+  Value value(boc::Rng& rng) { return Value(value_size, char('a' + rng.below(26))); }
+
+  void issue_batch(std::shared_ptr<Client> c) {
+    std::vector<Store::Op> ops;
+    size_t n = std::min(batch, c->remaining);
+    for (size_t i = 0; i < n; ++i) {
+      Key k = (*zipf)(c->rng);
+      if (c->rng.uniform() < mix.read)
+        ops.push_back(Store::Op{Store::Op::Get, k, {}});
+      else
+        ops.push_back(Store::Op{Store::Op::Put, k, value(c->rng)});
+    }
+    auto start = Clock::now();
+    store->apply(std::move(ops), [c, start, n](size_t hits) {
+      UNUSED(hits);
+      complete(c, start, n);
+    });
+  }
+
+  void issue(std::shared_ptr<Client> c) {
+    if (batch > 1)
+      return issue_batch(c);
+
+    Key k = (*zipf)(c->rng);
+    double r = c->rng.uniform();
+    auto start = Clock::now();
+    auto done = [c, start]() { complete(c, start, 1); };
+
+    if (mix.multi > 0) {
+      std::vector<Key> keys{k};
+      for (size_t i = 1; i < multi_keys; ++i)
+        keys.push_back((*zipf)(c->rng));
+      if (r < mix.multi) {
+        store->multi_get(std::move(keys), [done](std::vector<std::optional<Value>> values) {
+          for (auto& v : values)
+            check(v.has_value());
+          done();
+        });
+      } else {
+        std::vector<std::pair<Key, Value>> kvs;
+        for (auto key : keys)
+          kvs.emplace_back(key, value(c->rng));
+        store->multi_put(std::move(kvs), done);
+      }
+    } else if (r < mix.read) {
+      store->get(k, [done](const Value* v) {
+        check(v != nullptr);
+        done();
+      });
+    } else if (r < mix.read + mix.update) {
+      store->put(k, value(c->rng), done);
+    } else {
+      store->update(k, [](Value& v) { v[0] = char(v[0] == 'z' ? 'a' : v[0] + 1); }, [done](bool found) {
+        check(found);
+        done();
+      });
+    }
+  }
+
+  void run() {
+    store = std::make_unique<Store>(num_shards, num_records, Value(value_size, 'a'));
+    latencies = std::make_unique<boc::Latencies>();
+    finished = 0;
+
+    // a key beyond the loaded ones is put, read, removed and read again, in spawn order
+    Key fresh = num_records;
+    store->put(fresh, "fresh", []() {});
+    store->get(fresh, [](const Value* v) { check(v != nullptr && *v == "fresh"); });
+    store->remove(fresh, [](bool found) { check(found); });
+    store->get(fresh, [](const Value* v) { check(v == nullptr); });
+
+    for (size_t i = 0; i < num_clients; ++i) {
+      size_t share = num_ops / num_clients + (i < num_ops % num_clients);
+      auto c = std::make_shared<Client>(i + 1, share);
+      if (share > 0)
+        when() << [c]() { issue(c); };
+      else
+        finished++;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  KV::num_records = harness.opt.is<size_t>("--records", KV::num_records);
+  KV::num_ops = harness.opt.is<size_t>("--ops", KV::num_ops);
+  KV::num_clients = std::max<size_t>(harness.opt.is<size_t>("--clients", KV::num_clients), 1);
+  KV::num_shards = std::max<size_t>(harness.opt.is<size_t>("--shards", KV::num_shards), 1);
+  KV::batch = std::max<size_t>(harness.opt.is<size_t>("--batch", KV::batch), 1);
+  KV::multi_keys = std::max<size_t>(harness.opt.is<size_t>("--multi_keys", KV::multi_keys), 1);
+  KV::value_size = std::max<size_t>(harness.opt.is<size_t>("--value_size", KV::value_size), 1);
+  KV::workload = harness.opt.is<const char*>("--workload", KV::workload.c_str());
+  KV::mix = KV::parse(KV::workload);
+  if (KV::batch > 1 && KV::mix.read + KV::mix.update < 1) {
+    std::cerr << "--batch only batches gets and puts, workloads A B and C" << std::endl;
+    return 1;
+  }
+  KV::zipf = std::make_unique<boc::Zipf>(KV::num_records, std::atof(harness.opt.is<const char*>("--theta", "0.99")));
+
+  double t = boc::timed_run(harness, KV::run);
+  auto samples = KV::latencies->sorted();
+  boc::Report()("workload", KV::workload)("shards", KV::num_shards)("clients", KV::num_clients)("batch", KV::batch)
+    ("ops", samples.size())("seconds", t)("ops_per_second", samples.size() / t)
+    ("p50_us", boc::Latencies::percentile(samples, 0.5))("p99_us", boc::Latencies::percentile(samples, 0.99))
+    ("p999_us", boc::Latencies::percentile(samples, 0.999));
+}
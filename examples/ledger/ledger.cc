@@ -0,0 +1,143 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <memory>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/wal.h>
+
+using namespace verona::cpp;
+
+namespace Ledger {
+  /*
+   * A bank whose transfers are durable:
+   * - a transfer is an atomic when over both accounts, as in Bank::AtomicTransfer
+   * - once it has updated the accounts it appends a record to the write-ahead log and
+   *   the transfer is complete only when the log calls its completion, after the batch
+   *   holding the record has been written and fdatasync'ed
+   * - the log batches records from every worker into one write and fdatasync (group commit),
+   *   so the cost of syncing is shared by every transfer in the batch
+   * - records hold the amount moved by a successful transfer, so replaying them onto the
+   *   initial balances in any order recovers the final balances
+   *
+   * run performs num_transfers random transfers and then recover rebuilds the accounts from
+   * the log and checks they match the balances at the end of run.
+   */
+
+  struct Account {
+    int64_t balance;
+
+    Account(int64_t balance): balance(balance) {}
+  };
+
+  struct Transfer {
+    uint32_t src;
+    uint32_t dst;
+    int64_t amount;
+  };
+
+  using Log = boc::wal::Log<Transfer>;
+
+  size_t num_accounts = 1000;
+  size_t num_transfers = 100000;
+  size_t batch = 64;
+  int64_t initial_balance = 1000;
+  std::string path = "ledger.log";
+
+  std::vector<cown_ptr<Account>> accounts;
+  std::unique_ptr<Log> log;
+  std::atomic<size_t> completed{0};
+  std::vector<int64_t> final_balances;
+  size_t flushes = 0;
+
+  void transfer(uint32_t src, uint32_t dst, int64_t amount, Log::Completion done) {
+    when(accounts[src], accounts[dst]) << [src, dst, amount, done = std::move(done)](acquired_cown<Account> s, acquired_cown<Account> d) mutable {
+      if (s->balance < amount) {
+        done();
+        return;
+      }
+      s->balance -= amount;
+      d->balance += amount;
+      log->append(Transfer{src, dst, amount}, std::move(done));
+    };
+  }
+
+  void run() {
+    unlink(path.c_str());
+    log = std::make_unique<Log>(path, batch);
+    completed = 0;
+
+    accounts.clear();
+    for (size_t i = 0; i < num_accounts; ++i)
+      accounts.push_back(make_cown<Account>(initial_balance));
+
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < num_transfers; ++i) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      uint32_t src = uint32_t(x % num_accounts);
+      uint32_t dst = uint32_t((src + 1 + (x >> 32) % (num_accounts - 1)) % num_accounts);
+      transfer(src, dst, int64_t(x % 100), [](){ completed++; });
+    }
+
+    // every transfer has appended to the log before this runs, so the sync makes them all durable
+    when(cown_array<Account>(accounts.data(), accounts.size())) << [](acquired_cown_span<Account> all) {
+      final_balances.clear();
+      for (auto& account : all)
+        final_balances.push_back(account->balance);
+      // cowns must not outlive the run
+      accounts.clear();
+
+      log->sync();
+      log->stats([](size_t f, size_t bytes) {
+        UNUSED(bytes);
+        flushes = f;
+        check(log->error() == 0);
+        check(completed == num_transfers);
+        log.reset();
+      });
+    };
+  }
+
+  size_t recovered = 0;
+
+  void recover() {
+    std::vector<int64_t> balances(num_accounts, initial_balance);
+    recovered = 0;
+    Log::replay(path, [&balances](const Log::Entry& e) {
+      balances[e.record.src] -= e.record.amount;
+      balances[e.record.dst] += e.record.amount;
+      recovered++;
+    });
+
+    int64_t total = 0;
+    accounts.clear();
+    for (auto balance : balances) {
+      check(balance >= 0);
+      total += balance;
+      accounts.push_back(make_cown<Account>(balance));
+    }
+    check(total == initial_balance * int64_t(num_accounts));
+
+    if (!final_balances.empty())
+      check(balances == final_balances);
+    accounts.clear();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  Ledger::num_accounts = harness.opt.is<size_t>("--accounts", Ledger::num_accounts);
+  Ledger::num_transfers = harness.opt.is<size_t>("--transfers", Ledger::num_transfers);
+  Ledger::batch = harness.opt.is<size_t>("--batch", Ledger::batch);
+  Ledger::path = harness.opt.is<const char*>("--log", Ledger::path.c_str());
+
+  if (!harness.opt.has("--recover")) {
+    double t = boc::timed_run(harness, Ledger::run);
+    boc::Report()("phase", "transfer")("batch", Ledger::batch)("transfers", Ledger::num_transfers)("flushes", Ledger::flushes)
+      ("seconds", t)("transfers_per_second", Ledger::num_transfers / t);
+  }
+
+  double t = boc::timed_run(harness, Ledger::recover);
+  boc::Report()("phase", "recover")("records", Ledger::recovered)("seconds", t);
+}
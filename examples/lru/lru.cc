@@ -0,0 +1,268 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace LRU {
+  /*
+   * An LRU cache whose hits do not serialise readers:
+   * - keys are split over segments, each segment is a cown holding the entries and a
+   *   recency list, and has a capacity in bytes of capacity / segments
+   * - a lookup acquires its segment with read(), so hits on a segment run concurrently
+   * - a hit cannot move its entry to the front of the list with read access, instead it
+   *   records the key in the segment's touch buffer, and once touch_batch keys are buffered
+   *   a behaviour that writes the segment applies them all
+   * - recording a touch only try_locks the buffer and drops the touch if the buffer is busy
+   *   or full, recency is approximate but a hit never waits
+   * - an insert writes the segment and evicts from the back of the list until the segment
+   *   is within its capacity
+   *
+   * With eager recency every lookup writes its segment and moves a hit to the front at once,
+   * serialising the lookups of a segment like the writes to common_account in readonly.
+   */
+
+  using Key = uint64_t;
+  using Value = std::string;
+
+  // bookkeeping charged to each entry on top of its value
+  constexpr size_t overhead = 64;
+
+  struct Segment {
+    struct Entry {
+      Value value;
+      std::list<Key>::iterator position;
+    };
+
+    std::unordered_map<Key, Entry> entries;
+    std::list<Key> recency;
+    size_t bytes = 0;
+    size_t capacity;
+    size_t evictions = 0;
+
+    Segment(size_t capacity): capacity(capacity) {}
+
+    void touch(Key key) {
+      auto it = entries.find(key);
+      if (it != entries.end())
+        recency.splice(recency.begin(), recency, it->second.position);
+    }
+
+    void insert(Key key, Value value) {
+      auto it = entries.find(key);
+      if (it != entries.end()) {
+        bytes -= it->second.value.size();
+        bytes += value.size();
+        it->second.value = std::move(value);
+        recency.splice(recency.begin(), recency, it->second.position);
+      } else {
+        bytes += value.size() + overhead;
+        recency.push_front(key);
+        entries.emplace(key, Entry{std::move(value), recency.begin()});
+      }
+
+      while (bytes > capacity && recency.size() > 1) {
+        auto victim = entries.find(recency.back());
+        bytes -= victim->second.value.size() + overhead;
+        entries.erase(victim);
+        recency.pop_back();
+        evictions++;
+      }
+    }
+  };
+
+  class Cache {
+    struct Touches {
+      std::mutex lock;
+      std::vector<Key> keys;
+      bool scheduled = false;
+    };
+
+    std::vector<cown_ptr<Segment>> segments;
+    std::unique_ptr<Touches[]> touches;
+    const size_t touch_batch;
+    const bool eager;
+
+    size_t segment(Key key) const { return size_t((key * 0x9e3779b97f4a7c15ull) >> 32) % segments.size(); }
+
+    void touched(size_t s, Key key) {
+      auto& t = touches[s];
+      if (!t.lock.try_lock())
+        return;
+      if (t.keys.size() < 4 * touch_batch)
+        t.keys.push_back(key);
+      bool apply = t.keys.size() >= touch_batch && !t.scheduled;
+      t.scheduled |= apply;
+      t.lock.unlock();
+
+      if (!apply)
+        return;
+      when(segments[s]) << [&t](acquired_cown<Segment> segment) {
+        std::vector<Key> keys;
+        {
+          std::lock_guard<std::mutex> guard(t.lock);
+          std::swap(keys, t.keys);
+          t.scheduled = false;
+        }
+        for (auto k : keys)
+          segment->touch(k);
+      };
+    }
+
+  public:
+    Cache(size_t capacity, size_t num_segments, size_t touch_batch, bool eager)
+    : touches(new Touches[num_segments]), touch_batch(touch_batch), eager(eager) {
+      for (size_t i = 0; i < num_segments; ++i)
+        segments.push_back(make_cown<Segment>(capacity / num_segments));
+    }
+
+    // f(const Value*), null on a miss
+    template<typename F>
+    void get(Key key, F f) {
+      size_t s = segment(key);
+      if (eager) {
+        when(segments[s]) << [key, f = std::move(f)](acquired_cown<Segment> segment) mutable {
+          auto it = segment->entries.find(key);
+          if (it == segment->entries.end())
+            return f(nullptr);
+          segment->touch(key);
+          f(&it->second.value);
+        };
+        return;
+      }
+
+      when(read(segments[s])) << [this, s, key, f = std::move(f)](acquired_cown<const Segment> segment) mutable {
+        auto it = segment->entries.find(key);
+        if (it == segment->entries.end())
+          return f(nullptr);
+        // before f, which may spawn the behaviour that destroys the cache: a touch spawned
+        // first is ordered before it
+        touched(s, key);
+        f(&it->second.value);
+      };
+    }
+
+    void put(Key key, Value value) {
+      when(segments[segment(key)]) << [key, value = std::move(value)](acquired_cown<Segment> segment) mutable {
+        segment->insert(key, std::move(value));
+      };
+    }
+
+    // f(size_t bytes, size_t entries, size_t evictions) over every segment
+    template<typename F>
+    void stats(F f) {
+      when(read(cown_array<Segment>(segments.data(), segments.size()))) << [f = std::move(f)](acquired_cown_span<const Segment> all) mutable {
+        size_t bytes = 0, entries = 0, evictions = 0;
+        for (auto& s : all) {
+          check(s->bytes <= s->capacity || s->entries.size() == 1);
+          bytes += s->bytes;
+          entries += s->entries.size();
+          evictions += s->evictions;
+        }
+        f(bytes, entries, evictions);
+      };
+    }
+  };
+
+  /*
+   * Closed loop clients look up zipfian keys out of num_keys, on a miss the value is
+   * "loaded" and put in the cache, as a cache in front of a slower store would.
+   */
+
+  size_t num_keys = 1 << 20;
+  size_t num_ops = 1 << 20;
+  size_t num_clients = 64;
+  size_t num_segments = 64;
+  size_t capacity = 16 << 20;
+  size_t touch_batch = 64;
+  size_t value_size = 100;
+  bool eager = false;
+
+  using Clock = std::chrono::steady_clock;
+
+  std::unique_ptr<Cache> cache;
+  std::unique_ptr<boc::Zipf> zipf;
+  std::unique_ptr<boc::Latencies> latencies;
+  std::atomic<size_t> hits{0};
+  std::atomic<size_t> finished{0};
+  size_t cached_bytes = 0;
+  size_t evictions = 0;
+
+  struct Client {
+    boc::Rng rng;
+    size_t remaining;
+
+    Client(uint64_t seed, size_t remaining): rng(seed), remaining(remaining) {}
+  };
+
+  void lookup(std::shared_ptr<Client> c) {
+    Key k = (*zipf)(c->rng);
+    auto start = Clock::now();
+    cache->get(k, [c, k, start](const Value* v) {
+      if (v) {
+        check(v->size() == value_size && (*v)[0] == char('a' + k % 26));
+        hits++;
+      } else {
+        cache->put(k, Value(value_size, char('a' + k % 26)));
+      }
+      latencies->record(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+      if (--c->remaining > 0) {
+        lookup(c);
+      } else if (++finished == num_clients) {
+        cache->stats([](size_t bytes, size_t entries, size_t evicted) {
+          UNUSED(entries);
+          cached_bytes = bytes;
+          evictions = evicted;
+          // the segments must not outlive the run
+          cache.reset();
+        });
+      }
+    });
+  }
+
+  void run() {
+    cache = std::make_unique<Cache>(capacity, num_segments, touch_batch, eager);
+    latencies = std::make_unique<boc::Latencies>();
+    hits = 0;
+    finished = 0;
+
+    for (size_t i = 0; i < num_clients; ++i) {
+      size_t share = num_ops / num_clients + (i < num_ops % num_clients);
+      auto c = std::make_shared<Client>(i + 1, share);
+      if (share > 0)
+        when() << [c]() { lookup(c); };
+      else
+        finished++;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  LRU::num_keys = harness.opt.is<size_t>("--keys", LRU::num_keys);
+  LRU::num_ops = harness.opt.is<size_t>("--ops", LRU::num_ops);
+  LRU::num_clients = std::max<size_t>(harness.opt.is<size_t>("--clients", LRU::num_clients), 1);
+  LRU::num_segments = std::max<size_t>(harness.opt.is<size_t>("--segments", LRU::num_segments), 1);
+  LRU::capacity = harness.opt.is<size_t>("--capacity", LRU::capacity);
+  LRU::touch_batch = std::max<size_t>(harness.opt.is<size_t>("--touch_batch", LRU::touch_batch), 1);
+  LRU::value_size = std::max<size_t>(harness.opt.is<size_t>("--value_size", LRU::value_size), 1);
+  LRU::eager = harness.opt.has("--eager");
+  LRU::zipf = std::make_unique<boc::Zipf>(LRU::num_keys);
+
+  double t = boc::timed_run(harness, LRU::run);
+  auto samples = LRU::latencies->sorted();
+  boc::Report()("segments", LRU::num_segments)("recency", LRU::eager ? "eager" : "buffered")("capacity", LRU::capacity)
+    ("ops", samples.size())("hit_rate", double(LRU::hits) / std::max<size_t>(samples.size(), 1))
+    ("cached_bytes", LRU::cached_bytes)("evictions", LRU::evictions)("seconds", t)("ops_per_second", samples.size() / t)
+    ("p50_us", boc::Latencies::percentile(samples, 0.5))("p99_us", boc::Latencies::percentile(samples, 0.99));
+}
@@ -0,0 +1,186 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <memory>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/memo.h>
+
+using namespace verona::cpp;
+
+namespace Memo {
+  /*
+   * Recursive parallel computations whose sub-problems overlap, with and without a
+   * boc::Memo:
+   * - Fib, fib(n) = fib(n - 1) + fib(n - 2), as Fib::parallel but the recursion goes all
+   *   the way down, so without a memo it spawns behaviours for every one of the exponentially
+   *   many calls
+   * - Binomial, C(n, k) = C(n - 1, k - 1) + C(n - 1, k) modulo a prime, Pascal's triangle,
+   *   which without a memo recomputes each entry once per path to it
+   *
+   * Without a memo each call returns a cown that its caller joins on, as in Fib::parallel.
+   * With a memo each key is computed once, its computation gets both sub-problems from the
+   * memo and resolves its key once both values are there.
+   *
+   * The count of behaviours spawned is reported with the time.
+   */
+
+  using Value = uint64_t;
+  using Table = boc::Memo<uint64_t, Value>;
+
+  constexpr Value prime = 1000000007;
+
+  std::atomic<size_t> spawned{0};
+  std::unique_ptr<Table> table;
+
+  // calls resolve with the sum of the values of a and b, once both are known
+  void sum(uint64_t a, uint64_t b, Table::Resolve resolve, Value modulo) {
+    struct Join {
+      std::atomic<int> remaining{2};
+      std::atomic<Value> partial{0};
+    };
+    auto join = std::make_shared<Join>();
+    auto add = [join, resolve, modulo](const Value& v) {
+      join->partial += v;
+      if (--join->remaining == 0) {
+        Value total = join->partial;
+        resolve(modulo ? total % modulo : total);
+      }
+    };
+    table->get(a, add);
+    table->get(b, add);
+  }
+
+  namespace Fib {
+    cown_ptr<Value> parallel(uint64_t n) {
+      cown_ptr<Value> result = make_cown<Value>(Value(n));
+      if (n <= 1)
+        return result;
+      cown_ptr<Value> f2 = parallel(n - 2);
+      cown_ptr<Value> f1 = parallel(n - 1);
+      spawned++;
+      when(result, f1, f2) << [](acquired_cown<Value> result, acquired_cown<Value> f1, acquired_cown<Value> f2) {
+        *result = *f1 + *f2;
+      };
+      return result;
+    }
+
+    void compute(const uint64_t& n, Table::Resolve resolve) {
+      if (n <= 1)
+        return resolve(n);
+      sum(n - 1, n - 2, resolve, 0);
+    }
+
+    Value iterative(uint64_t n) {
+      Value a = 0, b = 1;
+      for (uint64_t i = 0; i < n; ++i)
+        b = std::exchange(a, b) + b;
+      return a;
+    }
+  }
+
+  namespace Binomial {
+    uint64_t key(uint64_t n, uint64_t k) { return n << 32 | k; }
+
+    cown_ptr<Value> parallel(uint64_t n, uint64_t k) {
+      cown_ptr<Value> result = make_cown<Value>(Value(1));
+      if (k == 0 || k == n)
+        return result;
+      cown_ptr<Value> a = parallel(n - 1, k - 1);
+      cown_ptr<Value> b = parallel(n - 1, k);
+      spawned++;
+      when(result, a, b) << [](acquired_cown<Value> result, acquired_cown<Value> a, acquired_cown<Value> b) {
+        *result = (*a + *b) % prime;
+      };
+      return result;
+    }
+
+    void compute(const uint64_t& key, Table::Resolve resolve) {
+      uint64_t n = key >> 32, k = key & 0xffffffff;
+      if (k == 0 || k == n)
+        return resolve(1);
+      sum(Binomial::key(n - 1, k - 1), Binomial::key(n - 1, k), resolve, prime);
+    }
+
+    Value iterative(uint64_t n, uint64_t k) {
+      std::vector<Value> row(k + 1, 0);
+      row[0] = 1;
+      for (uint64_t i = 1; i <= n; ++i)
+        for (uint64_t j = std::min(i, k); j > 0; --j)
+          row[j] = (row[j] + row[j - 1]) % prime;
+      return row[k];
+    }
+  }
+
+  std::string workload = "fib";
+  uint64_t n = 25;
+  uint64_t k = 12;
+  bool memo = false;
+
+  size_t behaviours = 0;
+  size_t computations = 0;
+  size_t waits = 0;
+
+  void check_and_release(Value v, Value expected) {
+    check(v == expected);
+    table->drain([]() {
+      behaviours = spawned + table->behaviours();
+      computations = table->computations();
+      waits = table->waits();
+      // the shards must not outlive the run
+      table.reset();
+    });
+  }
+
+  void bench() {
+    spawned = 0;
+    bool fib = workload == "fib";
+    Value expected = fib ? Fib::iterative(n) : Binomial::iterative(n, k);
+
+    if (!memo) {
+      verona::rt::schedule_lambda([fib, expected]() {
+        cown_ptr<Value> result = fib ? Fib::parallel(n) : Binomial::parallel(n, k);
+        when(result) << [expected](acquired_cown<Value> result) {
+          check(*result == expected);
+          behaviours = spawned;
+        };
+      });
+      return;
+    }
+
+    table = std::make_unique<Table>(fib ? Table::Compute(Fib::compute) : Table::Compute(Binomial::compute), fib ? n + 1 : (n + 1) * (k + 1));
+    verona::rt::schedule_lambda([fib, expected]() {
+      table->get(fib ? n : Binomial::key(n, k), [expected](const Value& v) { check_and_release(v, expected); });
+    });
+  }
+
+  void run() {
+    table = std::make_unique<Table>(Fib::compute, 64);
+    verona::rt::schedule_lambda([]() {
+      // the second get of 40 attaches to the first, or finds its value
+      table->get(40, [](const Value& v) { check(v == Fib::iterative(40)); });
+      table->get(40, [](const Value& v) { check_and_release(v, Fib::iterative(40)); });
+    });
+
+    verona::rt::schedule_lambda([]() {
+      when(Binomial::parallel(10, 4)) << [](acquired_cown<Value> result) { check(*result == 210); };
+    });
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  if (harness.opt.has("--n")) {
+    Memo::workload = harness.opt.is<const char*>("--workload", Memo::workload.c_str());
+    Memo::n = harness.opt.is<size_t>("--n", Memo::n);
+    Memo::k = std::min<uint64_t>(harness.opt.is<size_t>("--k", Memo::n / 2), Memo::n);
+    Memo::memo = harness.opt.has("--memo");
+
+    double t = boc::timed_run(harness, Memo::bench);
+    boc::Report()("workload", Memo::workload)("n", Memo::n)("k", Memo::workload == "fib" ? 0 : Memo::k)("memo", Memo::memo)
+      ("spawned", Memo::behaviours)("computations", Memo::computations)("waits", Memo::waits)("seconds", t);
+  } else {
+    harness.run(Memo::run);
+  }
+}
@@ -0,0 +1,153 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/pipeline.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace Pipeline {
+  /*
+   * Sensor readings through a five stage boc::pipeline:
+   *   source -> map (raw to celsius) -> filter (drop faulty readings) -> window (summary of
+   *   each window readings) -> map (score the summary) -> aggregate (totals) -> sink
+   *
+   * The two maps and the filter are stateless, window and aggregate own their state.  The
+   * source is a chain of behaviours, each generating chunk events and pushing them.
+   *
+   * With --batch 1 every event is a behaviour at every stage, without --fuse every stage is a
+   * cown.  The totals are checked against the same stages run sequentially.
+   */
+
+  struct Event {
+    uint32_t sensor;
+    int32_t raw;
+  };
+
+  struct Reading {
+    uint32_t sensor;
+    double celsius;
+  };
+
+  struct Summary {
+    double mean;
+    double max;
+  };
+
+  struct Score {
+    double spread;
+    bool hot;
+  };
+
+  struct Totals {
+    uint64_t windows = 0;
+    uint64_t hot = 0;
+    double spread = 0;
+
+    bool operator==(const Totals& o) const { return windows == o.windows && hot == o.hot && spread == o.spread; }
+  };
+
+  size_t num_events = 1000000;
+  size_t window = 64;
+  size_t chunk = 65536;
+  boc::pipeline::Options options;
+
+  Reading celsius(Event e) { return Reading{e.sensor, e.raw * 0.01}; }
+
+  bool valid(const Reading& r) { return r.celsius > -40.0; }
+
+  Summary summarise(std::vector<Reading>&& readings) {
+    double sum = 0;
+    double max = readings.front().celsius;
+    for (auto& r : readings) {
+      sum += r.celsius;
+      max = std::max(max, r.celsius);
+    }
+    return Summary{sum / double(readings.size()), max};
+  }
+
+  Score score(Summary s) { return Score{s.max - s.mean, s.mean > 25.0}; }
+
+  void total(Totals& t, const Score& s) {
+    t.windows++;
+    t.hot += s.hot;
+    t.spread += s.spread;
+  }
+
+  // readings between -50 and 50 degrees, sensors drifting warmer
+  Event generate(boc::Rng& rng, size_t i) {
+    uint32_t sensor = uint32_t(rng.below(256));
+    return Event{sensor, int32_t(rng.below(10000)) - 5000 + int32_t(i % 2000)};
+  }
+
+  using Source = boc::pipeline::Source<Event>;
+
+  std::unique_ptr<Source> source;
+  Totals result;
+
+  void produce(size_t from, boc::Rng rng) {
+    verona::rt::schedule_lambda([from, rng]() mutable {
+      size_t to = std::min(num_events, from + chunk);
+      for (size_t i = from; i < to; ++i)
+        source->push(generate(rng, i));
+      if (to == num_events)
+        source->close();
+      else
+        produce(to, rng);
+    });
+  }
+
+  void run() {
+    source = std::make_unique<Source>(boc::pipeline::from<Event>(options)
+      .map(celsius)
+      .filter(valid)
+      .window(window, summarise)
+      .map(score)
+      .aggregate(Totals(), total)
+      .sink([](std::vector<Totals>&& totals) { result = totals.back(); },
+            []() {
+              // cowns must not outlive the run
+              source.reset();
+            }));
+    produce(0, boc::Rng(42));
+  }
+
+  Totals sequential() {
+    boc::Rng rng(42);
+    Totals t;
+    std::vector<Reading> open;
+    for (size_t i = 0; i < num_events; ++i) {
+      Reading r = celsius(generate(rng, i));
+      if (!valid(r))
+        continue;
+      open.push_back(r);
+      if (open.size() == window) {
+        total(t, score(summarise(std::move(open))));
+        open.clear();
+      }
+    }
+    if (!open.empty())
+      total(t, score(summarise(std::move(open))));
+    return t;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  Pipeline::num_events = harness.opt.is<size_t>("--events", Pipeline::num_events);
+  Pipeline::window = std::max<size_t>(harness.opt.is<size_t>("--window", Pipeline::window), 1);
+  Pipeline::options.batch = std::max<size_t>(harness.opt.is<size_t>("--batch", Pipeline::options.batch), 1);
+  Pipeline::options.fuse = harness.opt.has("--fuse");
+
+  double t = boc::timed_run(harness, Pipeline::run);
+  boc::Report()("batch", Pipeline::options.batch)("fuse", Pipeline::options.fuse)("window", Pipeline::window)
+    ("events", Pipeline::num_events)("seconds", t)("events_per_second", Pipeline::num_events / t);
+
+  check(Pipeline::result == Pipeline::sequential());
+}
@@ -0,0 +1,143 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/priority.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace PriorityLanes {
+  /*
+   * A flood of background behaviours with periodic high priority ones:
+   * - num_background behaviours, each computing for work_usec on one of num_cowns cowns, are
+   *   spawned at once at the start
+   * - meanwhile a thread spawns num_high behaviours on a cown of their own, one every
+   *   period_usec, and each records how long it waited to start
+   *
+   * Without --lanes every behaviour is spawned with when, so a high priority behaviour queues
+   * behind the flood spawned before it.  With --lanes they are spawned through a boc::Lanes of
+   * bound behaviours (default twice the cores), the flood in the background lane and the
+   * others in the high lane.
+   */
+
+  struct Work {
+    uint64_t done = 0;
+  };
+
+  size_t num_background = 200000;
+  size_t work_usec = 50;
+  size_t num_cowns = 1024;
+  size_t num_high = 200;
+  size_t period_usec = 5000;
+  bool lanes = false;
+  size_t bound = 0;
+
+  using Clock = std::chrono::steady_clock;
+
+  std::unique_ptr<boc::Lanes> priority;
+  std::vector<cown_ptr<Work>> cowns;
+  cown_ptr<Work> urgent;
+  boc::Latencies latencies;
+  std::atomic<size_t> remaining{0};
+  std::atomic<size_t> computed{0};
+  std::atomic<int64_t> flood_ns{0};
+  Clock::time_point start;
+
+  void done() {
+    if (--remaining > 0)
+      return;
+    // cowns must not outlive the run
+    cowns.clear();
+    urgent = nullptr;
+  }
+
+  void background(size_t i) {
+    auto f = [](acquired_cown<Work> w) {
+      busy_loop(work_usec);
+      w->done++;
+      if (++computed == num_background)
+        flood_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+      done();
+    };
+    if (lanes)
+      priority->when(boc::Priority::background, cowns[i % cowns.size()]) << f;
+    else
+      when(cowns[i % cowns.size()]) << f;
+  }
+
+  void high(cown_ptr<Work> c) {
+    auto spawned = Clock::now();
+    auto f = [spawned](acquired_cown<Work> w) {
+      latencies.record(std::chrono::duration<double, std::micro>(Clock::now() - spawned).count());
+      w->done++;
+      done();
+    };
+    if (lanes)
+      priority->when(boc::Priority::high, c) << f;
+    else
+      when(c) << f;
+  }
+
+  // c is handed over from run, done clears urgent from a behaviour while this thread is running
+  void periodic(cown_ptr<Work> c) {
+    auto next = Clock::now();
+    for (size_t i = 0; i < num_high; ++i) {
+      next += std::chrono::microseconds(period_usec);
+      std::this_thread::sleep_until(next);
+      high(c);
+    }
+    c = nullptr;
+    verona::rt::Scheduler::remove_external_event_source();
+  }
+
+  void run(SystematicTestHarness* harness) {
+    cowns.clear();
+    for (size_t i = 0; i < num_cowns; ++i)
+      cowns.push_back(make_cown<Work>());
+    urgent = make_cown<Work>();
+    remaining = num_background + num_high + 1;
+    start = Clock::now();
+
+    verona::rt::Scheduler::add_external_event_source();
+    // moved on so that the lambda holds no reference once periodic drops c
+    harness->external_thread([c = urgent]() mutable { periodic(std::move(c)); });
+    verona::rt::schedule_lambda([]() {
+      for (size_t i = 0; i < num_background; ++i)
+        background(i);
+      done();
+    });
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  PriorityLanes::num_background = harness.opt.is<size_t>("--background", PriorityLanes::num_background);
+  PriorityLanes::work_usec = harness.opt.is<size_t>("--work_usec", PriorityLanes::work_usec);
+  PriorityLanes::num_cowns = std::max<size_t>(harness.opt.is<size_t>("--cowns", PriorityLanes::num_cowns), 1);
+  PriorityLanes::num_high = harness.opt.is<size_t>("--high", PriorityLanes::num_high);
+  PriorityLanes::period_usec = harness.opt.is<size_t>("--period_usec", PriorityLanes::period_usec);
+  PriorityLanes::lanes = harness.opt.has("--lanes");
+  PriorityLanes::bound = harness.opt.is<size_t>("--bound", 2 * harness.cores);
+
+  PriorityLanes::priority = std::make_unique<boc::Lanes>(PriorityLanes::bound, harness.cores);
+  double t = boc::timed_run(harness, PriorityLanes::run, &harness);
+  auto sorted = PriorityLanes::latencies.sorted();
+  double flood_s = PriorityLanes::flood_ns / 1e9;
+  boc::Report()("lanes", PriorityLanes::lanes)("bound", PriorityLanes::bound)("work_usec", PriorityLanes::work_usec)
+    ("seconds", t)("background_per_second", flood_s > 0 ? PriorityLanes::num_background / flood_s : 0.0)
+    ("p50_us", boc::Latencies::percentile(sorted, 0.5))("p99_us", boc::Latencies::percentile(sorted, 0.99))
+    ("max_us", sorted.empty() ? 0.0 : sorted.back());
+
+  check(sorted.size() == PriorityLanes::num_high);
+  check(PriorityLanes::computed == PriorityLanes::num_background);
+  PriorityLanes::priority.reset();
+}
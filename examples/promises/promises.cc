@@ -4,80 +4,16 @@
 #include <memory>
 #include <debug/harness.h>
 #include <cpp/when.h>
-#include <deque>
-#include <optional>
 #include <variant>
+#include <boc/promise.h>
 
 using namespace verona::cpp;
 
 namespace promises {
 
-  template<typename T>
-  class promise {
-
-    struct internal {
-      std::optional<const T> v;
-      std::deque<std::function<void(const T&)>> q;
-    };
-
-    cown_ptr<internal> inner;
-
-public:
-    promise(): inner(make_cown<internal>()) {}
-
-    promise<T>& then(std::function<void(const T&)> f) {
-      when(inner) << [f=std::move(f)](acquired_cown<internal> inner) mutable {
-        if (inner->v) {
-          f(inner->v.value());
-        } else {
-          inner->q.emplace_back(move(f));
-        }
-      };
-      return *this;
-    }
-
-    void fulfill(const T v) {
-      when(inner) << [v=std::move(v)](acquired_cown<internal> inner) mutable {
-        if (!inner->v) {
-          inner->v.emplace(std::move(v));
-          while (!inner->q.empty()) {
-            inner->q.front()(inner->v.value());
-            inner->q.pop_front();
-          }
-        }
-      };
-    }
-
-  };
-
-  namespace {
-    template<typename ...Args>
-    void _join(promise<std::tuple<Args...>> p, std::tuple<Args...> r) {
-      p.fulfill(r);
-    }
-
-    template<typename ...Args1, typename ...Args2, typename Arg, typename ...Args3>
-    void _join(promise<std::tuple<Args1...>> p, std::tuple<Args2...> r, promise<Arg> pr, promise<Args3>... prs) {
-      // Args1 = Args2 ++ [Arg] ++ Args3
-      pr.then([p, r, prs...](const auto& v) mutable {
-        _join(p, std::tuple_cat(r, std::make_tuple(v)), prs...);
-      });
-    }
-  }
-
-  template<typename ...Args>
-  promise<std::tuple<Args...>> join(promise<Args>... ps) {
-    promise<std::tuple<Args...>> p;
-    _join(p, std::make_tuple(), ps...);
-    return p;
-  }
-
-  template<typename ...Args>
-  promise<std::variant<Args...>> any(promise<Args>... ps) {
-    promise<std::variant<Args...>> p;
-    (ps.then([p](const auto& v) mutable {p.fulfill(v);}),...);
-    return p;
-  }
+  using boc::any;
+  using boc::join;
+  using boc::promise;
 
   void run1() {
     // How do i join on promises?
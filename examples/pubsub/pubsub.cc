@@ -0,0 +1,136 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/topic.h>
+
+using namespace verona::cpp;
+
+namespace PubSub {
+  /*
+   * One publisher broadcasting ticks to many subscribers through a boc::Topic:
+   * - the publisher is a chain of behaviours, each publishing a batch of ticks and spawning
+   *   the next once the topic has taken the batch
+   * - every subscriber is a cown counting the ticks it is handed and checking they arrive in
+   *   order, the first slow subscribers also spend slow_usec on each delivery
+   * - under --policy block every subscriber sees every tick and the publisher waits for the
+   *   slowest, under --policy drop the slow subscribers skip ticks instead
+   */
+
+  struct Tick {
+    uint64_t seq;
+    double price;
+    uint64_t pad[6];
+  };
+
+  struct Reader {
+    bool slow;
+    uint64_t received = 0;
+    uint64_t next = 0;
+    bool ordered = true;
+
+    Reader(bool slow): slow(slow) {}
+  };
+
+  using Topic = boc::Topic<Tick>;
+
+  size_t num_messages = 100000;
+  size_t num_subscribers = 100;
+  size_t batch = 64;
+  size_t max_lag = 4096;
+  size_t num_slow = 0;
+  size_t slow_usec = 100;
+  Topic::Policy policy = Topic::Policy::drop;
+
+  std::unique_ptr<Topic> topic;
+  std::vector<cown_ptr<Reader>> readers;
+  uint64_t delivered = 0;
+  uint64_t dropped = 0;
+
+  void receive(acquired_cown<Reader>& reader, const Topic::Message* ticks, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t seq = ticks[i]->seq;
+      bool in_order = policy == Topic::Policy::block ? seq == reader->next : seq >= reader->next;
+      reader->ordered = reader->ordered && in_order;
+      reader->next = seq + 1;
+    }
+    reader->received += n;
+    if (reader->slow)
+      busy_loop(slow_usec);
+  }
+
+  void finish() {
+    delivered = topic->deliveries();
+    dropped = topic->dropped();
+    if (readers.empty()) {
+      topic.reset();
+      return;
+    }
+    when(cown_array<Reader>(readers.data(), readers.size())) << [](acquired_cown_span<Reader> all) {
+      uint64_t received = 0;
+      for (auto& reader : all) {
+        check(reader->ordered);
+        check(reader->next == num_messages);
+        if (policy == Topic::Policy::block)
+          check(reader->received == num_messages);
+        received += reader->received;
+      }
+      check(received + dropped == uint64_t(num_messages) * num_subscribers);
+      // cowns must not outlive the run
+      readers.clear();
+      topic.reset();
+    };
+  }
+
+  void publish(size_t from) {
+    verona::rt::schedule_lambda([from]() {
+      size_t to = std::min(num_messages, from + batch);
+      std::vector<Topic::Message> ticks;
+      ticks.reserve(to - from);
+      for (size_t i = from; i < to; ++i)
+        ticks.push_back(std::make_shared<const Tick>(Tick{i, 100.0 + double(i % 1000) * 0.01, {}}));
+
+      topic->publish(std::move(ticks), [to]() {
+        if (to < num_messages)
+          publish(to);
+        else
+          topic->close(finish);
+      });
+    });
+  }
+
+  void run() {
+    topic = std::make_unique<Topic>(max_lag, policy);
+    readers.clear();
+    for (size_t i = 0; i < num_subscribers; ++i) {
+      readers.push_back(make_cown<Reader>(i < num_slow));
+      topic->subscribe(readers.back(), receive);
+    }
+    publish(0);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  PubSub::num_messages = harness.opt.is<size_t>("--messages", PubSub::num_messages);
+  PubSub::num_subscribers = harness.opt.is<size_t>("--subscribers", PubSub::num_subscribers);
+  PubSub::batch = std::max<size_t>(harness.opt.is<size_t>("--batch", PubSub::batch), 1);
+  PubSub::max_lag = std::max<size_t>(harness.opt.is<size_t>("--lag", PubSub::max_lag), 1);
+  PubSub::num_slow = harness.opt.is<size_t>("--slow", PubSub::num_slow);
+  PubSub::slow_usec = harness.opt.is<size_t>("--slow_usec", PubSub::slow_usec);
+  std::string policy = harness.opt.is<const char*>("--policy", "drop");
+  if (policy != "drop" && policy != "block")
+    throw std::runtime_error("--policy is drop or block");
+  PubSub::policy = policy == "block" ? PubSub::Topic::Policy::block : PubSub::Topic::Policy::drop;
+
+  double t = boc::timed_run(harness, PubSub::run);
+  boc::Report()("policy", policy)("subscribers", PubSub::num_subscribers)("slow", PubSub::num_slow)("batch", PubSub::batch)
+    ("lag", PubSub::max_lag)("messages", PubSub::num_messages)("seconds", t)("messages_per_second", PubSub::num_messages / t)
+    ("deliveries_per_second", PubSub::delivered / t)("dropped", PubSub::dropped);
+}
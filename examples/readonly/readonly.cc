@@ -1,8 +1,12 @@
 // Copyright Microsoft and Project Verona Contributors.
 // SPDX-License-Identifier: MIT
+#include <algorithm>
 #include <memory>
 #include <debug/harness.h>
 #include <cpp/when.h>
+#include <boc/profiler.h>
+#include <boc/admission.h>
+#include <boc/bench.h>
 
 using namespace verona::cpp;
 
@@ -17,6 +21,7 @@ namespace ReadOnly {
 
   size_t num_accounts = 1 << 10;
   size_t work_usec = 10000;
+  size_t bound = 0;
 
   template<typename T>
   constexpr cown_ptr<T> write(cown_ptr<T> o) { return o; }
@@ -46,18 +51,19 @@ namespace ReadOnly {
       accounts.push_back(make_cown<Account>(0));
 
     cown_ptr<Account> common_account = make_cown<Account>(100);
-    when(common_account) << [](acquired_cown<Account> account) {
+    boc::profile::Tag common[] = {boc::profile::tag("common_account")};
+    when(common_account) << boc::profile::track(common, [](acquired_cown<Account> account) {
       busy_loop(work_usec);
       account->balance -= 10;
-    };
+    });
 
     // 2 * num_accounts potentially parallel jobs
     for (size_t i = 0 ; i < num_accounts; i++)
     {
-      when(accounts[i], op(common_account)) << [](acquired_cown<Account> write_account, acquired_cown<To> ro_account) {
+      when(accounts[i], op(common_account)) << boc::profile::track("copy", common, [](acquired_cown<Account> write_account, acquired_cown<To> ro_account) {
         busy_loop(work_usec);
         write_account->balance = ro_account->balance;
-      };
+      });
 
       when(op(accounts[i])) << [](acquired_cown<To> account) {
         busy_loop(work_usec);
@@ -65,28 +71,103 @@ namespace ReadOnly {
       };
     }
 
-    when(common_account) << [](acquired_cown<Account> account) {
+    when(common_account) << boc::profile::track(common, [](acquired_cown<Account> account) {
       busy_loop(work_usec);
       account->balance += 10;
-    };
+    });
 
-    when(op(common_account)) << [](acquired_cown<To> account) {
+    when(op(common_account)) << boc::profile::track(common, [](acquired_cown<To> account) {
       busy_loop(work_usec);
       check(account->balance == 100);
+    });
+  }
+
+  /*
+   * The same workload under admission control: rather than scheduling all 2 * num_accounts
+   * behaviours up front, the loop is throttled to bound outstanding behaviours and each
+   * account is only created when its behaviours are spawned.
+   * The final behaviours on common_account are spawned once the loop has finished, so the
+   * happens before relations are the same as in run.
+   */
+  std::unique_ptr<boc::Admission> admission;
+
+  template<typename To, typename From>
+  void run_bounded(AccessOp<To, From> op) {
+    admission = std::make_unique<boc::Admission>(bound);
+
+    cown_ptr<Account> common_account = make_cown<Account>(100);
+    boc::profile::Tag common[] = {boc::profile::tag("common_account")};
+    when(common_account) << boc::profile::track(common, [](acquired_cown<Account> account) {
+      busy_loop(work_usec);
+      account->balance -= 10;
+    });
+
+    boc::profile::Tag tag = common[0];
+    auto spawn = [op, common_account, tag](size_t) {
+      boc::profile::Tag common[] = {tag};
+      cown_ptr<Account> account = make_cown<Account>(0);
+
+      when(account, op(common_account)) << admission->track(boc::profile::track("copy", common, [](acquired_cown<Account> write_account, acquired_cown<To> ro_account) {
+        busy_loop(work_usec);
+        write_account->balance = ro_account->balance;
+      }));
+
+      when(op(account)) << admission->track([](acquired_cown<To> account) {
+        busy_loop(work_usec);
+        check(account->balance == 90);
+      });
     };
+
+    auto then = [op, common_account, tag]() {
+      boc::profile::Tag common[] = {tag};
+      when(common_account) << boc::profile::track(common, [](acquired_cown<Account> account) {
+        busy_loop(work_usec);
+        account->balance += 10;
+      });
+
+      when(op(common_account)) << boc::profile::track(common, [](acquired_cown<To> account) {
+        busy_loop(work_usec);
+        check(account->balance == 100);
+      });
+    };
+
+    admission->for_each(0, num_accounts, 2, spawn, then);
   }
 
-  void test_write() { run(&write<Account>); }
+  void test_write() {
+    if (bound)
+      run_bounded(&write<Account>);
+    else
+      run(&write<Account>);
+  }
 
-  void test_read() { run(&read<Account>); }
+  void test_read() {
+    if (bound)
+      run_bounded(&read<Account>);
+    else
+      run(&read<Account>);
+  }
 
 }
 
 int main(int argc, char** argv)
 {
   SystematicTestHarness harness(argc, argv);
+  boc::profile::configure(harness.opt);
+  boc::trace::configure(harness.opt);
+  ReadOnly::num_accounts = harness.opt.is<size_t>("--accounts", ReadOnly::num_accounts);
+  ReadOnly::work_usec = harness.opt.is<size_t>("--work_usec", ReadOnly::work_usec);
+  ReadOnly::bound = harness.opt.is<size_t>("--bound", ReadOnly::bound);
+  // each account spawns two behaviours, which are admitted together
+  if (ReadOnly::bound != 0)
+    ReadOnly::bound = std::max<size_t>(ReadOnly::bound, 2);
+  double t;
   if (harness.opt.has("--ro"))
-    harness.run(ReadOnly::test_read);
+    t = boc::timed_run(harness, ReadOnly::test_read);
   else
-    harness.run(ReadOnly::test_write);
+    t = boc::timed_run(harness, ReadOnly::test_write);
+  boc::Report()("accounts", ReadOnly::num_accounts)("work_usec", ReadOnly::work_usec)("bound", ReadOnly::bound)
+    ("seconds", t)("peak_rss_kb", boc::peak_rss_kb());
+  boc::trace::dump();
+  boc::profile::report();
 }
\ No newline at end of file
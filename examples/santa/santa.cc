@@ -1,8 +1,12 @@
 // Copyright Microsoft and Project Verona Contributors.
 // SPDX-License-Identifier: MIT
+#include <atomic>
 #include <memory>
 #include <debug/harness.h>
 #include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/guard.h>
+#include <boc/profiler.h>
 
 using namespace verona::cpp;
 
@@ -33,9 +37,24 @@ namespace SantaProblem {
    *   - once complete, the elves or reindeer are returned to their original pools
    *
    * - We use Santa as a counter of how many meetings can occur so that the problem terminates
+   *
+   * With --guarded santa, the ready queues and santa are boc::Guarded and the meetings are a single
+   * boc::whenever over them, woken by the groups being pushed on the ready queues, in place of
+   * the process behaviours.  A process behaviour that finds nothing to do (the meetings are over)
+   * and a guard evaluation that finds nothing ready are the wasted behaviours.
    */
 
-  struct Santa { int count; }; // We use santa as a job count
+  size_t meetings = 50;
+  bool guarded = false;
+  bool quiet = false;
+  std::atomic<size_t> behaviours{0};
+  std::atomic<size_t> wasted{0};
+  std::atomic<size_t> met{0};
+
+  struct Santa : public boc::Guarded { // We use santa as a job count
+    int count;
+    Santa(int count): count(count) {}
+  };
   struct Reindeer {};
   struct Elf {};
 
@@ -49,43 +68,54 @@ namespace SantaProblem {
   using Group = std::vector<std::unique_ptr<T>>;
 
   template<typename T>
-  using ReadyQueue = std::queue<Group<T>>;
+  struct ReadyQueue : public std::queue<Group<T>>, public boc::Guarded {};
 
   template<typename T>
   struct Collections {
     cown_ptr<Pool<T>> pool;
     cown_ptr<ReadyQueue<T>> ready;
     const size_t threshold;
+    const boc::profile::Tag pool_tag;
+    const boc::profile::Tag ready_tag;
 
-    Collections(size_t threshold): pool(make_cown<Pool<T>>()), ready(make_cown<ReadyQueue<T>>()), threshold(threshold) {}
+    Collections(size_t threshold, const std::string& name)
+    : pool(make_cown<Pool<T>>()), ready(make_cown<ReadyQueue<T>>()), threshold(threshold),
+      pool_tag(boc::profile::tag(name + " pool")), ready_tag(boc::profile::tag(name + " ready")) {}
   };
 
   struct Workshop {
     cown_ptr<Santa> santa;
+    const boc::profile::Tag santa_tag;
     Imm<Collections<Reindeer>> reindeer_collections;
     Imm<Collections<Elf>> elf_collections;
 
     template<typename T>
     static void add_entity(Imm<Workshop> ws, Imm<Collections<T>> collections, std::unique_ptr<T> entity) {
-      when(collections->pool) << [ws, collections, entity = move(entity)](acquired_cown<Pool<T>> pool) mutable {
+      boc::profile::Tag tags[] = {collections->pool_tag};
+      when(collections->pool) << boc::profile::track("add entity", tags, [ws, collections, entity = move(entity)](acquired_cown<Pool<T>> pool) mutable {
         pool->push(move(entity));
 
         if (pool->size() >= collections->threshold) {
 
-          Group<T> sg(collections->threshold);
+          Group<T> sg;
+          sg.reserve(collections->threshold);
           size_t i = 0;
           while (i++ < collections->threshold) {
             sg.push_back(move(pool->front()));
             pool->pop();
           }
 
-          when(collections->ready) << [sg = move(sg), ws](acquired_cown<ReadyQueue<T>> ready) mutable {
+          boc::profile::Tag tags[] = {collections->ready_tag};
+          when(collections->ready) << boc::profile::track("ready", tags, [sg = move(sg), ws](acquired_cown<ReadyQueue<T>> ready) mutable {
             ready->push(move(sg));
-          };
+            if (guarded)
+              ready->signal();
+          });
 
-          Workshop::process(ws);
+          if (!guarded)
+            Workshop::process(ws);
         }
-      };
+      });
     }
 
     template<typename T>
@@ -96,32 +126,67 @@ namespace SantaProblem {
       }
     }
 
+    static void meet(Imm<Workshop> ws, acquired_cown<ReadyQueue<Reindeer>>& ready_reindeer, acquired_cown<ReadyQueue<Elf>>& ready_elves) {
+      if(!ready_reindeer->empty()) {
+        if (!quiet)
+          std::cout << "Reindeer and Santa meet to work" << std::endl;
+        Workshop::return_entities<Reindeer>(ws, ws->reindeer_collections, move(ready_reindeer->front()));
+        ready_reindeer->pop();
+
+      } else if (!ready_elves->empty()){
+        if (!quiet)
+          std::cout << "Elves and Santa meet to work" << std::endl;
+        Workshop::return_entities<Elf>(ws, ws->elf_collections, move(ready_elves->front()));
+        ready_elves->pop();
+
+      } else {
+        check(false && "we should not having pending processes without work available");
+      }
+      if (++met == meetings)
+        // the guard holds the workshop weakly, see guard
+        workshop.reset();
+    }
+
     static void process(Imm<Workshop> ws) {
-      when(ws->santa, ws->reindeer_collections->ready, ws->elf_collections->ready) << [ws](acquired_cown<Santa> santa, acquired_cown<ReadyQueue<Reindeer>> ready_reindeer, acquired_cown<ReadyQueue<Elf>> ready_elves){
+      behaviours++;
+      boc::profile::Tag tags[] = {ws->santa_tag, ws->reindeer_collections->ready_tag, ws->elf_collections->ready_tag};
+      when(ws->santa, ws->reindeer_collections->ready, ws->elf_collections->ready) << boc::profile::track("meet", tags, [ws](acquired_cown<Santa> santa, acquired_cown<ReadyQueue<Reindeer>> ready_reindeer, acquired_cown<ReadyQueue<Elf>> ready_elves){
         if((santa->count)-- > 0) {
-          if(!ready_reindeer->empty()) {
-            std::cout << "Reindeer and Santa meet to work" << std::endl;
-            Workshop::return_entities<Reindeer>(ws, ws->reindeer_collections, move(ready_reindeer->front()));
-            ready_reindeer->pop();
-
-          } else if (!ready_elves->empty()){
-            std::cout << "Elves and Santa meet to work" << std::endl;
-            Workshop::return_entities<Elf>(ws, ws->elf_collections, move(ready_elves->front()));
-            ready_elves->pop();
-
-          } else {
-            check(false && "we should not having pending processes without work available");
-          }
+          Workshop::meet(ws, ready_reindeer, ready_elves);
+        } else {
+          wasted++;
         }
+      });
+    }
+
+    /*
+     * The cowns of a guard hold it, so the guard holds the workshop weakly and the workshop is
+     * kept alive by workshop until the last meeting.
+     */
+    static void guard(Imm<Workshop> ws) {
+      std::weak_ptr<const Workshop> weak = ws;
+      boc::whenever([](acquired_cown<Santa>& santa, acquired_cown<ReadyQueue<Reindeer>>& ready_reindeer, acquired_cown<ReadyQueue<Elf>>& ready_elves) {
+        return santa->count > 0 && (!ready_reindeer->empty() || !ready_elves->empty());
+      }, ws->santa, ws->reindeer_collections->ready, ws->elf_collections->ready) << [weak](acquired_cown<Santa>& santa, acquired_cown<ReadyQueue<Reindeer>>& ready_reindeer, acquired_cown<ReadyQueue<Elf>>& ready_elves) {
+        santa->count--;
+        Workshop::meet(weak.lock(), ready_reindeer, ready_elves);
       };
     }
 
-    Workshop(): santa(make_cown<Santa>(Santa{50})),
-                reindeer_collections(std::make_shared<const Collections<Reindeer>>(9)),
-                elf_collections(std::make_shared<const Collections<Elf>>(3)) {}
+    static inline Imm<Workshop> workshop;
+
+    Workshop(): santa(make_cown<Santa>(int(meetings))),
+                santa_tag(boc::profile::tag("santa")),
+                reindeer_collections(std::make_shared<const Collections<Reindeer>>(9, "reindeer")),
+                elf_collections(std::make_shared<const Collections<Elf>>(3, "elf")) {}
 
     static void create() {
       Imm<Workshop> ws = std::make_shared<const Workshop>();
+      // with no meetings the last meeting never releases workshop, so there is no guard to hold
+      if (guarded && meetings > 0) {
+        workshop = ws;
+        Workshop::guard(ws);
+      }
 
       for (size_t i = 0; i < 9; ++i) {
         Workshop::add_entity<Reindeer>(ws, ws->reindeer_collections, std::make_unique<Reindeer>());
@@ -143,5 +208,20 @@ namespace SantaProblem {
 int main(int argc, char** argv)
 {
   SystematicTestHarness harness(argc, argv);
-  harness.run(SantaProblem::run);
+  SantaProblem::meetings = harness.opt.is<size_t>("--meetings", SantaProblem::meetings);
+  SantaProblem::guarded = harness.opt.has("--guarded");
+  SantaProblem::quiet = harness.opt.has("--quiet");
+  boc::profile::configure(harness.opt);
+  boc::trace::configure(harness.opt);
+  double t = boc::timed_run(harness, SantaProblem::run);
+  boc::trace::dump();
+  boc::profile::report();
+
+  auto& guards = boc::Guarded::counters();
+  size_t behaviours = SantaProblem::guarded ? guards.evaluations.load() : SantaProblem::behaviours.load();
+  size_t wasted = SantaProblem::guarded ? guards.wasted.load() : SantaProblem::wasted.load();
+  boc::Report()("guarded", SantaProblem::guarded)("meetings", SantaProblem::meetings)("seconds", t)
+    ("meetings_per_second", SantaProblem::met / t)("spawned", behaviours)("wasted", wasted);
+
+  check(SantaProblem::met == SantaProblem::meetings);
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/select.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace Select {
+  /*
+   * One consumer taking values from whichever of num_channels channels has one, fed by
+   * producers that each compute for work_usec between writes to random channels.
+   *
+   * - select: each wait is one boc::Channel::select, one behaviour over every channel and a
+   *   single waiter registered on all of them, the losing registrations are dead once the
+   *   waiter is claimed
+   * - naive (--naive): each wait is a read on every channel with its own callback, as with
+   *   Channels::Channel, the first callback to be called wins and every other callback that is
+   *   later handed a value writes it back to its channel
+   *
+   * The consumer is faster than the producers, so it mostly waits on empty channels.
+   */
+
+  using Channel = boc::Channel<uint64_t>;
+
+  size_t num_channels = 16;
+  size_t num_values = 100000;
+  size_t num_producers = 4;
+  size_t work_usec = 2;
+  bool naive = false;
+
+  std::vector<cown_ptr<Channel>> channels;
+  size_t received = 0;
+  uint64_t sum = 0;
+  std::atomic<size_t> waits{0};
+  std::atomic<size_t> requeued{0};
+
+  void consumed(uint64_t value);
+
+  void wait() {
+    waits++;
+    if (!naive) {
+      Channel::select(channels, [](size_t, uint64_t value) { consumed(value); });
+      return;
+    }
+
+    auto won = std::make_shared<std::atomic<bool>>(false);
+    for (size_t i = 0; i < channels.size(); ++i) {
+      Channel::read(channels[i], [won, i](uint64_t value) {
+        if (!won->exchange(true))
+          return consumed(value);
+        requeued++;
+        Channel::write(channels[i], value);
+      });
+    }
+  }
+
+  void consumed(uint64_t value) {
+    sum += value;
+    if (++received < num_values)
+      return wait();
+    // every value has been consumed, so nothing is being written back
+    channels.clear();
+  }
+
+  void produce(size_t producer, size_t remaining, boc::Rng rng) {
+    verona::rt::schedule_lambda([producer, remaining, rng]() mutable {
+      busy_loop(work_usec);
+      Channel::write(channels[rng.below(channels.size())], remaining);
+      if (remaining > 1)
+        produce(producer, remaining - 1, rng);
+    });
+  }
+
+  void run() {
+    channels.clear();
+    for (size_t i = 0; i < num_channels; ++i)
+      channels.push_back(make_cown<Channel>());
+    received = 0;
+    sum = 0;
+    if (num_values == 0) {
+      channels.clear();
+      return;
+    }
+
+    wait();
+    for (size_t p = 0; p < num_producers; ++p) {
+      size_t share = num_values / num_producers + (p < num_values % num_producers);
+      if (share > 0)
+        produce(p, share, boc::Rng(p + 1));
+    }
+  }
+
+  uint64_t expected() {
+    uint64_t total = 0;
+    for (size_t p = 0; p < num_producers; ++p) {
+      uint64_t share = num_values / num_producers + (p < num_values % num_producers);
+      total += share * (share + 1) / 2;
+    }
+    return total;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  Select::num_channels = std::max<size_t>(harness.opt.is<size_t>("--channels", Select::num_channels), 1);
+  Select::num_values = harness.opt.is<size_t>("--values", Select::num_values);
+  Select::num_producers = std::max<size_t>(harness.opt.is<size_t>("--producers", Select::num_producers), 1);
+  Select::work_usec = harness.opt.is<size_t>("--work_usec", Select::work_usec);
+  Select::naive = harness.opt.has("--naive");
+
+  double t = boc::timed_run(harness, Select::run);
+  boc::Report()("mode", Select::naive ? "naive" : "select")("channels", Select::num_channels)("producers", Select::num_producers)
+    ("values", Select::num_values)("seconds", t)("values_per_second", Select::num_values / t)
+    ("waits_per_second", Select::waits / t)("requeued", Select::requeued.load());
+
+  check(Select::received == Select::num_values);
+  check(Select::sum == Select::expected());
+}
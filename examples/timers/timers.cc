@@ -0,0 +1,163 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/promise.h>
+#include <boc/timer.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace TimerWheel {
+  /*
+   * A million timers on a boc::Timers:
+   * - inserters behaviours each set num_timers / inserters timers, due between min_ms and
+   *   min_ms + spread_ms from now, each spawning a behaviour on one of num_cowns cowns that
+   *   records how late it ran (the jitter), then cancel cancel_rate of them
+   * - meanwhile num_promises promises are given a timeout of timeout_ms with
+   *   boc::with_timeout, half of them are fulfilled at once and half are never fulfilled,
+   *   timed_out is the number that timed out
+   *
+   * Inserts and cancels are timed per inserter, their rates are of the slowest inserter.
+   */
+
+  struct Sink {
+    uint64_t fired = 0;
+  };
+
+  size_t num_timers = 1000000;
+  size_t inserters = 4;
+  double cancel_rate = 0.5;
+  size_t min_ms = 200;
+  size_t spread_ms = 1000;
+  size_t num_cowns = 64;
+  size_t num_promises = 1000;
+  size_t timeout_ms = 500;
+  std::chrono::microseconds resolution{1000};
+
+  using Clock = std::chrono::steady_clock;
+
+  std::unique_ptr<boc::Timers> timers;
+  std::vector<cown_ptr<Sink>> sinks;
+  boc::Latencies jitter;
+  std::atomic<size_t> remaining{0};
+  std::atomic<size_t> cancelled{0};
+  std::atomic<size_t> timed_out{0};
+  std::atomic<size_t> answered{0};
+  std::atomic<int64_t> insert_ns{0};
+  std::atomic<int64_t> cancel_ns{0};
+
+  void done() {
+    if (--remaining > 0)
+      return;
+    timers->close();
+    // cowns must not outlive the run
+    sinks.clear();
+  }
+
+  void max(std::atomic<int64_t>& slowest, Clock::duration d) {
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    int64_t seen = slowest;
+    while (seen < ns && !slowest.compare_exchange_weak(seen, ns))
+      ;
+  }
+
+  void insert(size_t inserter, size_t count) {
+    verona::rt::schedule_lambda([inserter, count]() {
+      boc::Rng rng(inserter + 1);
+      std::vector<boc::Timers::Handle> handles;
+      handles.reserve(count);
+
+      auto start = Clock::now();
+      for (size_t i = 0; i < count; ++i) {
+        auto delay = std::chrono::milliseconds(min_ms) + std::chrono::microseconds(rng.below(spread_ms * 1000 + 1));
+        auto due = Clock::now() + delay;
+        handles.push_back(timers->when_after(delay, [due](acquired_cown<Sink> sink) {
+          jitter.record(std::chrono::duration<double, std::micro>(Clock::now() - due).count());
+          sink->fired++;
+          done();
+        }, sinks[(inserter + i) % sinks.size()]));
+      }
+      max(insert_ns, Clock::now() - start);
+
+      start = Clock::now();
+      size_t cancels = 0;
+      for (auto& h : handles) {
+        if (rng.uniform() < cancel_rate && timers->cancel(h))
+          cancels++;
+      }
+      max(cancel_ns, Clock::now() - start);
+      cancelled += cancels;
+      for (size_t i = 0; i < cancels; ++i)
+        done();
+    });
+  }
+
+  void promises() {
+    for (size_t i = 0; i < num_promises; ++i) {
+      boc::promise<size_t> p;
+      boc::with_timeout(*timers, p, std::chrono::milliseconds(timeout_ms)).then([i](const std::optional<size_t>& v) {
+        if (v)
+          check(*v == i);
+        else
+          timed_out++;
+        answered++;
+        done();
+      });
+      if (i % 2 == 0)
+        p.fulfill(i);
+    }
+  }
+
+  void run(SystematicTestHarness* harness) {
+    timers = std::make_unique<boc::Timers>(resolution);
+    harness->external_thread([]() { timers->serve(); });
+    sinks.clear();
+    for (size_t i = 0; i < num_cowns; ++i)
+      sinks.push_back(make_cown<Sink>());
+
+    // one more for this behaviour, so nothing finishes before everything is spawned
+    remaining = num_timers + num_promises + 1;
+    promises();
+    for (size_t i = 0; i < inserters; ++i)
+      insert(i, num_timers / inserters + (i < num_timers % inserters));
+    done();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  TimerWheel::num_timers = harness.opt.is<size_t>("--timers", TimerWheel::num_timers);
+  TimerWheel::inserters = std::max<size_t>(harness.opt.is<size_t>("--inserters", TimerWheel::inserters), 1);
+  TimerWheel::cancel_rate = std::atof(harness.opt.is<const char*>("--cancel_rate", "0.5"));
+  TimerWheel::min_ms = harness.opt.is<size_t>("--min_ms", TimerWheel::min_ms);
+  TimerWheel::spread_ms = harness.opt.is<size_t>("--spread_ms", TimerWheel::spread_ms);
+  TimerWheel::num_cowns = std::max<size_t>(harness.opt.is<size_t>("--cowns", TimerWheel::num_cowns), 1);
+  TimerWheel::num_promises = harness.opt.is<size_t>("--promises", TimerWheel::num_promises);
+  TimerWheel::timeout_ms = harness.opt.is<size_t>("--timeout_ms", TimerWheel::timeout_ms);
+  TimerWheel::resolution = std::chrono::microseconds(std::max<size_t>(harness.opt.is<size_t>("--resolution_us", 1000), 1));
+
+  double t = boc::timed_run(harness, TimerWheel::run, &harness);
+  auto sorted = TimerWheel::jitter.sorted();
+  size_t fired = TimerWheel::num_timers - TimerWheel::cancelled;
+  double insert_s = std::max(TimerWheel::insert_ns.load(), int64_t(1)) / 1e9;
+  double cancel_s = std::max(TimerWheel::cancel_ns.load(), int64_t(1)) / 1e9;
+  boc::Report()("timers", TimerWheel::num_timers)("resolution_us", TimerWheel::resolution.count())("seconds", t)
+    ("inserts_per_second", TimerWheel::num_timers / insert_s)("cancels_per_second", TimerWheel::num_timers / cancel_s)
+    ("fires_per_second", fired / t)("p50_jitter_us", boc::Latencies::percentile(sorted, 0.5))
+    ("p99_jitter_us", boc::Latencies::percentile(sorted, 0.99))("max_jitter_us", sorted.empty() ? 0.0 : sorted.back())
+    ("promises", TimerWheel::num_promises)("timed_out", TimerWheel::timed_out.load());
+
+  check(sorted.size() == fired);
+  check(TimerWheel::answered == TimerWheel::num_promises);
+  // a fulfilled promise may still time out if its fulfill is late
+  check(TimerWheel::timed_out >= TimerWheel::num_promises / 2);
+  TimerWheel::timers.reset();
+}
@@ -0,0 +1,121 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <memory>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+
+using namespace verona::cpp;
+
+namespace WhenMany {
+  /*
+   * Compares the cost of acquiring n cowns in one behaviour through:
+   * - the variadic form, when(c0, c1, ..., cn) with the cowns fixed at compile time, and
+   * - the runtime form, when(cown_array) with the cowns in a vector.
+   *
+   * Every behaviour acquires every cown so all behaviours are serialised, what is measured
+   * is the per cown cost of scheduling, dispatching and releasing a behaviour.
+   *
+   * In mixed mode the first half of the cowns are acquired for writing and the second half
+   * for reading.
+   *
+   * The variadic form is only instantiated up to max_variadic cowns, beyond that compile time
+   * and binary size grow too quickly to be useful (which is the problem cown_array solves).
+   */
+
+  struct Counter {
+    size_t count = 0;
+  };
+
+  constexpr size_t max_variadic = 64;
+
+  std::vector<cown_ptr<Counter>> make_counters(size_t n) {
+    std::vector<cown_ptr<Counter>> cowns;
+    for (size_t i = 0; i < n; ++i)
+      cowns.push_back(make_cown<Counter>());
+    return cowns;
+  }
+
+  void touch(acquired_cown<Counter>& c) { c->count++; }
+
+  void touch(acquired_cown<const Counter>& c) { UNUSED(c->count); }
+
+  void span(size_t n, size_t behaviours, bool mixed) {
+    auto cowns = make_counters(n);
+    cown_array<Counter> all(cowns.data(), n);
+    cown_array<Counter> writes(cowns.data(), n / 2);
+    cown_array<Counter> reads(cowns.data() + n / 2, n - n / 2);
+
+    for (size_t b = 0; b < behaviours; ++b) {
+      if (mixed)
+        when(writes, read(reads)) << [](acquired_cown_span<Counter> ws, acquired_cown_span<const Counter> rs) {
+          for (auto& w : ws)
+            touch(w);
+          for (auto& r : rs)
+            touch(r);
+        };
+      else
+        when(all) << [](acquired_cown_span<Counter> ws) {
+          for (auto& w : ws)
+            touch(w);
+        };
+    }
+  }
+
+  template<size_t I, size_t n>
+  auto access(cown_ptr<Counter> c) {
+    if constexpr (I < n / 2)
+      return c;
+    else
+      return read(c);
+  }
+
+  template<size_t n, size_t... I>
+  void variadic_impl(std::vector<cown_ptr<Counter>>& cowns, size_t behaviours, bool mixed, std::index_sequence<I...>) {
+    for (size_t b = 0; b < behaviours; ++b) {
+      if (mixed)
+        when(access<I, n>(cowns[I])...) << [](auto... cs) { (touch(cs), ...); };
+      else
+        when(cowns[I]...) << [](auto... cs) { (touch(cs), ...); };
+    }
+  }
+
+  template<size_t n>
+  void variadic(size_t behaviours, bool mixed) {
+    auto cowns = make_counters(n);
+    variadic_impl<n>(cowns, behaviours, mixed, std::make_index_sequence<n>{});
+  }
+
+  template<size_t n = 2>
+  void run_variadic(size_t cowns, size_t behaviours, bool mixed) {
+    if constexpr (n <= max_variadic) {
+      if (cowns == n)
+        variadic<n>(behaviours, mixed);
+      else
+        run_variadic<n * 2>(cowns, behaviours, mixed);
+    }
+  }
+
+  void run_span(size_t cowns, size_t behaviours, bool mixed) {
+    span(cowns, behaviours, mixed);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  size_t max_cowns = harness.opt.is<size_t>("--max_cowns", 1024);
+  size_t behaviours = harness.opt.is<size_t>("--behaviours", 1000);
+  bool mixed = harness.opt.has("--mixed");
+  const char* mode = mixed ? "mixed" : "write";
+
+  for (size_t n = 2; n <= max_cowns; n *= 2) {
+    double t = boc::timed_run(harness, WhenMany::run_span, n, behaviours, mixed);
+    boc::Report()("form", "span")("mode", mode)("cowns", n)("behaviours", behaviours)("seconds", t);
+
+    if (n <= WhenMany::max_variadic) {
+      t = boc::timed_run(harness, WhenMany::run_variadic<>, n, behaviours, mixed);
+      boc::Report()("form", "variadic")("mode", mode)("cowns", n)("behaviours", behaviours)("seconds", t);
+    }
+  }
+}
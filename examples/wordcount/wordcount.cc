@@ -0,0 +1,226 @@
+// Copyright Microsoft and Project Verona Contributors.
+// SPDX-License-Identifier: MIT
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <debug/harness.h>
+#include <cpp/when.h>
+#include <boc/bench.h>
+#include <boc/dc.h>
+#include <boc/workload.h>
+
+using namespace verona::cpp;
+
+namespace WordCount {
+  /*
+   * Counting the words of a file, map-reduce style:
+   * - the file is memory-mapped read only and split into chunks of chunk_size bytes
+   * - each chunk is counted by one behaviour into a hash map keyed by string_views into the
+   *   mapping, so no word is copied
+   * - the maps are merged by a reduction tree, the chunks are the leaves of a boc::dc
+   *   problem and each combine merges the smaller of two maps into the larger
+   * - the maps are per chunk rather than per worker: a behaviour's map is its result, so no
+   *   map is shared between behaviours or outlives the reduction, at the cost of merging one
+   *   map per chunk rather than one per worker
+   *
+   * A word belongs to the chunk holding its first byte: a chunk skips a word that started in
+   * the previous chunk and reads past its end to finish its own last word.  Words are
+   * separated by ASCII whitespace.
+   *
+   * Without --file a file of generate_mb megabytes of zipfian words is used, written the first
+   * time it is needed and reused by later runs.
+   */
+
+  using Counts = std::unordered_map<std::string_view, uint64_t>;
+
+  bool space(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v'; }
+
+  // counts the words starting in [from, to) of data[0, size)
+  Counts count(const char* data, size_t size, size_t from, size_t to) {
+    Counts counts;
+    size_t i = from;
+    if (i > 0)
+      while (i < size && !space(data[i - 1]) && !space(data[i]))
+        i++;
+    while (i < to) {
+      while (i < size && space(data[i]))
+        i++;
+      if (i >= to)
+        break;
+      size_t start = i;
+      while (i < size && !space(data[i]))
+        i++;
+      counts[std::string_view(data + start, i - start)]++;
+    }
+    return counts;
+  }
+
+  struct Chunks {
+    size_t lo;
+    size_t hi;
+  };
+
+  struct Ops {
+    using Problem = Chunks;
+    using Result = Counts;
+
+    const char* data;
+    size_t size;
+    size_t chunk_size;
+
+    bool is_base(const Chunks& c) const { return c.hi - c.lo == 1; }
+
+    Counts base(Chunks c) const { return count(data, size, c.lo * chunk_size, std::min(size, c.hi * chunk_size)); }
+
+    std::pair<Chunks, Chunks> split(Chunks c) const {
+      size_t mid = c.lo + (c.hi - c.lo) / 2;
+      return {Chunks{c.lo, mid}, Chunks{mid, c.hi}};
+    }
+
+    Counts combine(Counts&& l, Counts&& r) const {
+      if (l.size() < r.size())
+        std::swap(l, r);
+      for (auto& [word, n] : r)
+        l[word] += n;
+      return std::move(l);
+    }
+  };
+
+  class Mapping {
+    void* base = nullptr;
+    size_t length = 0;
+
+  public:
+    explicit Mapping(const std::string& path) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+        throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+      struct stat st;
+      if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("cannot stat " + path + ": " + strerror(errno));
+      }
+      length = size_t(st.st_size);
+      if (length > 0) {
+        base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+          close(fd);
+          throw std::runtime_error("cannot map " + path + ": " + strerror(errno));
+        }
+        madvise(base, length, MADV_SEQUENTIAL);
+      }
+      close(fd);
+    }
+
+    Mapping(const Mapping&) = delete;
+
+    ~Mapping() {
+      if (length > 0)
+        munmap(base, length);
+    }
+
+    const char* data() const { return static_cast<const char*>(base); }
+
+    size_t size() const { return length; }
+  };
+
+  // writes path unless it exists, the words are the same for every run
+  void generate(const std::string& path, size_t bytes) {
+    if (access(path.c_str(), R_OK) == 0)
+      return;
+    boc::Rng rng(42);
+    std::vector<std::string> vocabulary;
+    for (size_t i = 0; i < 50000; ++i) {
+      std::string w(3 + rng.below(8), ' ');
+      for (auto& c : w)
+        c = char('a' + rng.below(26));
+      vocabulary.push_back(w);
+    }
+    boc::Zipf zipf(vocabulary.size(), 0.99, false);
+
+    // written aside and renamed, so an interrupted run never leaves a short file at path
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    std::string line;
+    size_t written = 0;
+    while (written < bytes) {
+      line.clear();
+      for (size_t i = 0; i < 12; ++i) {
+        line += vocabulary[zipf(rng)];
+        line += i == 11 ? '\n' : ' ';
+      }
+      out << line;
+      written += line.size();
+    }
+    out.close();
+    if (!out || rename(tmp.c_str(), path.c_str()) != 0)
+      throw std::runtime_error("cannot write " + path + ": " + strerror(errno));
+  }
+
+  std::unique_ptr<Mapping> mapping;
+  size_t chunk_size = 8 << 20;
+  bool sequential = false;
+  Counts result;
+
+  void run() {
+    const char* data = mapping->data();
+    size_t size = mapping->size();
+
+    if (sequential || size == 0) {
+      verona::rt::schedule_lambda([data, size]() { result = count(data, size, 0, size); });
+      return;
+    }
+
+    size_t chunks = (size + chunk_size - 1) / chunk_size;
+    Ops ops{data, size, chunk_size};
+    verona::rt::schedule_lambda([ops, chunks]() {
+      when(boc::dc::solve(ops, Chunks{0, chunks})) << [](acquired_cown<Counts> counts) {
+        result = std::move(*counts);
+      };
+    });
+  }
+
+  uint64_t words(const Counts& counts) {
+    uint64_t total = 0;
+    for (auto& kv : counts)
+      total += kv.second;
+    return total;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  SystematicTestHarness harness(argc, argv);
+  std::string path = harness.opt.is<const char*>("--file", "");
+  if (path.empty()) {
+    size_t mb = harness.opt.is<size_t>("--generate_mb", 64);
+    path = "/tmp/wordcount-" + std::to_string(mb) + "mb.txt";
+    WordCount::generate(path, mb << 20);
+  }
+  WordCount::chunk_size = std::max<size_t>(harness.opt.is<size_t>("--chunk_kb", WordCount::chunk_size >> 10), 1) << 10;
+  WordCount::sequential = harness.opt.has("--sequential");
+  WordCount::mapping = std::make_unique<WordCount::Mapping>(path);
+
+  double t = boc::timed_run(harness, WordCount::run);
+  size_t bytes = WordCount::mapping->size();
+  boc::Report()("mode", WordCount::sequential ? "sequential" : "boc")("chunk_kb", WordCount::chunk_size >> 10)("bytes", bytes)
+    ("words", WordCount::words(WordCount::result))("distinct", WordCount::result.size())("seconds", t)("bytes_per_second", bytes / t);
+
+  if (!harness.opt.has("--sequential") && !harness.opt.has("--file")) {
+    // the generated file is checked against a single count of the whole file
+    auto expected = WordCount::count(WordCount::mapping->data(), bytes, 0, bytes);
+    check(expected == WordCount::result);
+  }
+  WordCount::result.clear();
+  WordCount::mapping.reset();
+}
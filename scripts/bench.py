@@ -0,0 +1,307 @@
+"""
+Runs every example target under a declared parameter matrix and checks for
+regressions against a stored baseline.
+
+- Targets are discovered the same way CMakeLists.txt does, one per directory in
+  examples/, and run from the build directory. The optimised <example>_bench
+  target is used unless --variant plain is given.
+- The matrix is declared in benchmarks.json: for each example a set (or list of
+  sets) of parameters whose cross product is run for each core count, repeats
+  times. A boolean parameter is a flag that is passed when true.
+- Each run is pinned to the first n cpus with taskset and passed --cores n.
+- The metrics of a run are its wall clock time ("wall_seconds") and the fields of
+  the "result,key=value,..." lines it prints (see boc/bench.h) whose names match
+  the "metrics" pattern in benchmarks.json, the other fields of a line label it.
+  Metrics ending in "_per_second" or "_rate" are better when higher, all others
+  when lower.
+- A run that prints a line starting "skipped," (such as divide --impl par built
+  without TBB) is recorded as skipped with that line, and is not compared.
+- A run that fails or times out is recorded with its error in place of its
+  remaining samples and the matrix carries on; compared against a baseline in
+  which it succeeded, the failure counts as a regression.
+- Results are written to a JSON file with the git commit of this repository and
+  the verona-rt tag and commit the build used.
+- With --baseline, each metric is compared to the baseline with Welch's t-test and
+  flagged as a regression when it is significantly worse by more than --threshold.
+  The script exits with status 1 if any regression is found.
+"""
+
+import argparse
+import datetime
+import itertools
+import json
+import math
+import os
+import platform
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def getopts():
+    parser = argparse.ArgumentParser(description='Run the example benchmarks.')
+    parser.add_argument('--build', default=os.path.join(ROOT, 'build'),
+                        help='build directory containing the example targets')
+    parser.add_argument('--matrix', default=os.path.join(ROOT, 'scripts', 'benchmarks.json'),
+                        help='parameter matrix')
+    parser.add_argument('--variant', choices=['bench', 'plain'], default='bench',
+                        help='run the optimised <example>_bench targets or the plain <example> targets')
+    parser.add_argument('--only', nargs='*', help='only run these examples')
+    parser.add_argument('--include-skipped', action='store_true',
+                        help='also run examples the matrix marks as skipped')
+    parser.add_argument('--repeats', type=int, help='override the repeats in the matrix')
+    parser.add_argument('--cores', type=int, nargs='*', help='override the core counts in the matrix')
+    parser.add_argument('--no-pin', action='store_true', help='do not pin runs with taskset')
+    parser.add_argument('-o', default=os.path.join(ROOT, 'results'), help='results directory')
+    parser.add_argument('--baseline', help='results file to compare against')
+    parser.add_argument('--compare', help='compare this results file to --baseline instead of running')
+    parser.add_argument('--alpha', type=float, default=0.01, help='significance level')
+    parser.add_argument('--threshold', type=float, default=0.05,
+                        help='smallest relative change reported as a regression')
+    return parser.parse_args()
+
+
+def discover(build, variant):
+    examples = sorted(d for d in os.listdir(os.path.join(ROOT, 'examples'))
+                      if os.path.isdir(os.path.join(ROOT, 'examples', d)))
+    suffix = '_bench' if variant == 'bench' else ''
+    return {e: os.path.join(build, e + suffix) for e in examples}
+
+
+def git(*args, cwd=ROOT):
+    try:
+        return subprocess.run(['git', *args], cwd=cwd, check=True, capture_output=True,
+                              text=True).stdout.strip()
+    except (subprocess.CalledProcessError, FileNotFoundError):
+        return None
+
+
+def metadata(build, variant):
+    # the tag the build was configured with, see BOC_VERONA_RT_TAG in CMakeLists.txt
+    tag = None
+    cache = os.path.join(build, 'CMakeCache.txt')
+    if os.path.exists(cache):
+        with open(cache) as f:
+            tag = re.search(r'^BOC_VERONA_RT_TAG:\w+=(\S+)$', f.read(), re.M)
+    verona_src = os.path.join(build, '_deps', 'verona-src')
+    return {
+        'date': datetime.datetime.now().isoformat(timespec='seconds'),
+        'commit': git('rev-parse', 'HEAD'),
+        'dirty': bool(git('status', '--porcelain', '--untracked-files=no')),
+        'verona_tag': tag.group(1) if tag else None,
+        'verona_commit': git('rev-parse', 'HEAD', cwd=verona_src) if os.path.isdir(verona_src) else None,
+        'variant': variant,
+        'host': platform.node(),
+        'cpus': os.cpu_count(),
+    }
+
+
+def expand(params):
+    """The cross product of a parameter set, or of each set in a list."""
+    if isinstance(params, list):
+        return [c for p in params for c in expand(p)]
+    keys = list(params)
+    return [dict(zip(keys, values)) for values in itertools.product(*(params[k] for k in keys))]
+
+
+def command_line(config):
+    args = []
+    for key, value in config.items():
+        if value is True:
+            args.append(key)
+        elif value is not False:
+            args += [key, str(value)]
+    return args
+
+
+def parse_results(output, pattern):
+    metrics = {}
+    for line in output.splitlines():
+        if not line.startswith('result,'):
+            continue
+        fields = dict(field.split('=', 1) for field in line.split(',')[1:] if '=' in field)
+        # a run may print several result lines, so metrics are keyed by the labels of their line
+        labels = [f'{k}={v}' for k, v in fields.items() if not pattern.match(k)]
+        for k, v in fields.items():
+            if pattern.match(k):
+                metrics['/'.join(labels + [k])] = float(v)
+    return metrics
+
+
+def run(binary, config, cores, pin, timeout, pattern):
+    args = [binary, '--cores', str(cores)] + command_line(config)
+    if pin:
+        args = ['taskset', '--cpu-list', f'0-{cores - 1}'] + args
+    start = time.time()
+    proc = subprocess.run(args, capture_output=True, text=True, timeout=timeout)
+    end = time.time()
+    if proc.returncode != 0:
+        raise RuntimeError(f'{" ".join(args)} failed with {proc.returncode}:\n{proc.stderr}')
+    skipped = [line for line in proc.stdout.splitlines() if line.startswith('skipped,')]
+    if skipped:
+        return {'skipped': skipped[0]}
+    metrics = parse_results(proc.stdout, pattern)
+    metrics['wall_seconds'] = end - start
+    return metrics
+
+
+def key(example, config, cores):
+    return f'{example} {" ".join(command_line(config))} --cores {cores}'.replace('  ', ' ')
+
+
+def run_all(opts):
+    with open(opts.matrix) as f:
+        matrix = json.load(f)
+    defaults = matrix['defaults']
+    pattern = re.compile(defaults['metrics'])
+    targets = discover(opts.build, opts.variant)
+    results = {'meta': metadata(opts.build, opts.variant), 'runs': {}}
+
+    for example, binary in targets.items():
+        spec = matrix['benchmarks'].get(example, {})
+        if opts.only and example not in opts.only:
+            continue
+        if 'skip' in spec and not opts.include_skipped:
+            print(f'{example}: skipped, {spec["skip"]}')
+            continue
+        if not os.path.exists(binary):
+            print(f'{example}: not built, skipped')
+            continue
+
+        repeats = opts.repeats or spec.get('repeats', defaults['repeats'])
+        for config in expand(spec.get('params', {})):
+            for cores in opts.cores or spec.get('cores', defaults['cores']):
+                name = key(example, config, cores)
+                print(name, end=' ', flush=True)
+                samples, error, skipped = [], None, None
+                for _ in range(repeats):
+                    try:
+                        sample = run(binary, config, cores, not opts.no_pin,
+                                     spec.get('timeout', defaults['timeout']), pattern)
+                    except subprocess.TimeoutExpired as e:
+                        error = f'timed out after {e.timeout}s'
+                        break
+                    except RuntimeError as e:
+                        error = str(e)
+                        break
+                    if 'skipped' in sample:
+                        skipped = sample['skipped']
+                        break
+                    samples.append(sample)
+                    print('.', end='', flush=True)
+                print(f' FAILED: {error.splitlines()[0]}' if error else f' {skipped}' if skipped else '')
+                results['runs'][name] = {
+                    'example': example, 'params': config, 'cores': cores,
+                    'metrics': {m: [s[m] for s in samples if m in s] for m in (samples[0] if samples else {})},
+                }
+                if error:
+                    results['runs'][name]['error'] = error
+                if skipped:
+                    results['runs'][name]['skipped'] = skipped
+
+    os.makedirs(opts.o, exist_ok=True)
+    meta = results['meta']
+    out = os.path.join(opts.o, f'{meta["date"].replace(":", "")}-{(meta["commit"] or "unknown")[:12]}.json')
+    with open(out, 'w') as f:
+        json.dump(results, f, indent=2)
+    print(f'results written to {out}')
+    return results
+
+
+def betacf(a, b, x):
+    """Continued fraction for the regularised incomplete beta function."""
+    qab, qap, qam = a + b, a + 1, a - 1
+    c, d = 1.0, 1.0 - qab * x / qap
+    d = 1.0 / (d if abs(d) > 1e-30 else 1e-30)
+    h = d
+    for m in range(1, 200):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((qam + m2) * (a + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > 1e-30 else 1e-30)
+        c = 1.0 + aa / c
+        c = c if abs(c) > 1e-30 else 1e-30
+        h *= d * c
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > 1e-30 else 1e-30)
+        c = 1.0 + aa / c
+        c = c if abs(c) > 1e-30 else 1e-30
+        delta = d * c
+        h *= delta
+        if abs(delta - 1.0) < 3e-12:
+            break
+    return h
+
+
+def betai(a, b, x):
+    if x <= 0.0 or x >= 1.0:
+        return 0.0 if x <= 0.0 else 1.0
+    front = math.exp(math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b)
+                     + a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1) / (a + b + 2):
+        return front * betacf(a, b, x) / a
+    return 1.0 - front * betacf(b, a, 1.0 - x) / b
+
+
+def welch(xs, ys):
+    """Two sided p-value of Welch's t-test that xs and ys have the same mean."""
+    if len(xs) < 2 or len(ys) < 2:
+        return 1.0
+    vx, vy = statistics.variance(xs) / len(xs), statistics.variance(ys) / len(ys)
+    if vx + vy == 0:
+        return 0.0 if statistics.mean(xs) != statistics.mean(ys) else 1.0
+    t = (statistics.mean(xs) - statistics.mean(ys)) / math.sqrt(vx + vy)
+    df = (vx + vy) ** 2 / (vx ** 2 / (len(xs) - 1) + vy ** 2 / (len(ys) - 1))
+    return betai(df / 2, 0.5, df / (df + t * t))
+
+
+def compare(baseline, current, alpha, threshold):
+    print(f'baseline {baseline["meta"]["commit"]} (verona {baseline["meta"]["verona_tag"]}) '
+          f'vs {current["meta"]["commit"]} (verona {current["meta"]["verona_tag"]})')
+    if baseline['meta'].get('variant') != current['meta'].get('variant'):
+        print('warning: comparing results from different target variants')
+    regressions = 0
+    for name, run in sorted(current['runs'].items()):
+        base = baseline['runs'].get(name)
+        if not base or 'skipped' in run or 'skipped' in base:
+            continue
+        if 'error' in run:
+            regressions += 'error' not in base
+            print(f'{"FAILED":12} {name}: {run["error"].splitlines()[0]}')
+            continue
+        for metric, samples in sorted(run['metrics'].items()):
+            old = base['metrics'].get(metric)
+            if not old or not samples:
+                continue
+            old_mean, new_mean = statistics.mean(old), statistics.mean(samples)
+            if old_mean == 0:
+                continue
+            change = (new_mean - old_mean) / old_mean
+            worse = -change if metric.endswith(('_per_second', '_rate')) else change
+            p = welch(old, samples)
+            if p < alpha and abs(change) > threshold:
+                flag = 'REGRESSION' if worse > 0 else 'improvement'
+                regressions += worse > 0
+                print(f'{flag:12} {name} {metric}: {old_mean:.4g} -> {new_mean:.4g} '
+                      f'({change:+.1%}, p={p:.2g})')
+    print(f'{regressions} regression(s)')
+    return regressions
+
+
+if __name__ == '__main__':
+    opts = getopts()
+    if opts.compare:
+        with open(opts.compare) as f:
+            current = json.load(f)
+    else:
+        current = run_all(opts)
+
+    if opts.baseline:
+        with open(opts.baseline) as f:
+            baseline = json.load(f)
+        sys.exit(1 if compare(baseline, current, opts.alpha, opts.threshold) else 0)